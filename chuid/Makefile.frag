@@ -6,3 +6,20 @@
 #macros.h: caps.c chuid.c compatibility.c helpers.c extension.c
 #	$(CPP) $(COMMON_FLAGS) -dD $^ | $(CPP) $(DEFS) $(CPPFLAGS) -dM - > $@
 
+
+PHP_CGI ?= $(dir $(PHP_EXECUTABLE))php-cgi
+PHP_FPM ?=
+BENCH_REQUESTS ?= 20000
+BENCH_DOCROOTS ?= 16
+BENCH_TENANTS ?= 64
+BENCH_WORKERS ?= $(shell nproc 2>/dev/null || echo 2)
+BENCH_CLIENTS ?= $(BENCH_WORKERS)
+BENCH_CLIENT_REQUESTS ?= 5000
+
+.PHONY: bench bench-load
+
+bench: all
+	$(PHP_EXECUTABLE) $(srcdir)/bench/microbench.php --cgi="$(PHP_CGI)" --fpm="$(PHP_FPM)" --extension="$(phplibdir)/chuid.so" --requests=$(BENCH_REQUESTS) --docroots=$(BENCH_DOCROOTS)
+
+bench-load: all
+	$(PHP_EXECUTABLE) $(srcdir)/bench/loadbench.php --cgi="$(PHP_CGI)" --extension="$(phplibdir)/chuid.so" --tenants=$(BENCH_TENANTS) --workers=$(BENCH_WORKERS) --clients=$(BENCH_CLIENTS) --requests=$(BENCH_CLIENT_REQUESTS)
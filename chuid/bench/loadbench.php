@@ -0,0 +1,186 @@
+<?php
+/**
+ * Measures the end-to-end throughput of a multi-tenant php-cgi FastCGI server with different chuid configurations:
+ * several concurrent clients send requests for N document roots owned by distinct users, either sticking to one tenant
+ * per client ("same") or picking a random tenant for every request ("random").
+ * Reports requests per second, p50/p99 latency and the resident set size of the workers.
+ *
+ * Usage: php loadbench.php --cgi=/path/to/php-cgi --extension=/path/to/chuid.so
+ *            [--tenants=N] [--workers=N] [--clients=N] [--requests=N] [--base=DIR]
+ *
+ * --requests is the number of requests per client. The document roots are created under --base,
+ * which defaults to /dev/shm (tmpfs), so that the disk does not take part in the measurement.
+ * Must be run as root; otherwise the benchmark is skipped.
+ */
+
+require __DIR__ . '/fcgi.inc';
+
+$opts = getopt('', ['cgi:', 'extension:', 'tenants::', 'workers::', 'clients::', 'requests::', 'base::', 'client', 'address:', 'tenant-file:', 'order:', 'seed:', 'out:']);
+
+if (isset($opts['client'])) {
+    run_client($opts['address'], unserialize(file_get_contents($opts['tenant-file'])), $opts['order'], (int)$opts['requests'], (int)$opts['seed'], $opts['out']);
+    exit(0);
+}
+
+$nproc = (int)trim((string)shell_exec('nproc 2>/dev/null')) ?: 2;
+$opts += [
+    'cgi'       => 'php-cgi',
+    'extension' => __DIR__ . '/../modules/chuid.so',
+    'tenants'   => 64,
+    'workers'   => $nproc,
+    'clients'   => $nproc,
+    'requests'  => 5000,
+    'base'      => is_dir('/dev/shm') ? '/dev/shm' : sys_get_temp_dir(),
+];
+
+skip_unless_root();
+
+$tenants  = max(1, (int)$opts['tenants']);
+$workers  = max(1, (int)$opts['workers']);
+$clients  = max(1, (int)$opts['clients']);
+$requests = max(1, (int)$opts['requests']);
+$base     = $opts['base'] . '/chuid-load-' . getmypid();
+$jail     = $base . '/jail';
+$socket   = $jail . '/php.sock';
+$roots    = make_docroots($jail, $tenants);
+
+/* Every configuration: INI settings and whether the document roots are seen from inside $jail */
+$configs = [
+    'chuid disabled'                => [['chuid.enabled' => 0], false],
+    'switching'                     => [[], false],
+    'switching, cache, defer'       => [['chuid.docroot_cache_ttl' => 60, 'chuid.defer_restore' => 1, 'cgi.fix_pathinfo' => 0], false],
+    'fsuid'                         => [['chuid.mode' => 'fsuid', 'chuid.docroot_cache_ttl' => 60, 'disable_functions' => 'exec,passthru,shell_exec,system,proc_open,popen,pcntl_exec,pcntl_setpriority,mail,mb_send_mail'], false],
+    'per-request chroot'            => [['chuid.enable_per_request_chroot' => 1, 'chuid.chroot_to' => $jail], false],
+    'per-request chroot, fd cache'  => [['chuid.enable_per_request_chroot' => 1, 'chuid.chroot_to' => $jail, 'chuid.chroot_fd_cache_size' => 64, 'chuid.docroot_cache_ttl' => 60], false],
+    'global chroot'                 => [['chuid.global_chroot' => $jail], true],
+];
+
+printf("%d tenants, %d workers, %d clients x %d requests, tree under %s\n\n", $tenants, $workers, $clients, $requests, $opts['base']);
+printf("%-30s %-7s %10s %10s %10s %14s\n", 'Configuration', 'Order', 'req/s', 'p50, us', 'p99, us', 'RSS avg/max, MiB');
+
+try {
+    foreach ($configs as $name => [$ini, $inside]) {
+        $ini   += ['chuid.enabled' => 1, 'chuid.never_root' => 1];
+        $params = [];
+        foreach ($roots as $root) {
+            $params[] = fcgi_params($inside ? substr($root, strlen($jail)) : $root);
+        }
+
+        file_put_contents($base . '/tenants', serialize($params));
+
+        [$proc, $pid, $address] = start_php_cgi($opts['cgi'], $opts['extension'], $ini, $socket, $workers, $inside ? '/php.sock' : null);
+        try {
+            foreach (['same', 'random'] as $order) {
+                $r = run_clients($address, $base, $order, $clients, $requests);
+                $rss = workers_rss($pid);
+                printf(
+                    "%-30s %-7s %10.0f %10.1f %10.1f %14s\n",
+                    $name, $order, $r['rps'], $r['p50'] / 1000, $r['p99'] / 1000,
+                    $rss ? sprintf('%.1f/%.1f', array_sum($rss) / count($rss) / 1024, max($rss) / 1024) : '-'
+                );
+            }
+        }
+        finally {
+            stop_php_cgi($proc);
+        }
+    }
+}
+finally {
+    rrmdir($base);
+}
+
+/**
+ * Starts the clients as separate processes and waits for them
+ *
+ * @return array{rps: float, p50: float, p99: float} Throughput and latency percentiles, in ns
+ */
+function run_clients(string $address, string $base, string $order, int $clients, int $requests): array
+{
+    $procs = [];
+    for ($i = 0; $i < $clients; ++$i) {
+        $cmd = [
+            PHP_BINARY, '-n', __FILE__, '--client',
+            '--address=' . $address,
+            '--tenant-file=' . $base . '/tenants',
+            '--order=' . $order,
+            '--requests=' . $requests,
+            '--seed=' . $i,
+            '--out=' . $base . '/client' . $i,
+        ];
+
+        $procs[] = proc_open(implode(' ', array_map('escapeshellarg', $cmd)), [0 => ['file', '/dev/null', 'r'], 2 => STDERR], $pipes);
+    }
+
+    foreach ($procs as $proc) {
+        proc_close($proc);
+    }
+
+    $first     = PHP_INT_MAX;
+    $last      = 0;
+    $latencies = [];
+    for ($i = 0; $i < $clients; ++$i) {
+        $data = (string)file_get_contents($base . '/client' . $i);
+        unlink($base . '/client' . $i);
+        $v     = array_values(unpack('P*', $data));
+        $first = min($first, $v[0]);
+        $last  = max($last, $v[1]);
+        array_push($latencies, ...array_slice($v, 2));
+    }
+
+    sort($latencies);
+    $n = count($latencies);
+    return [
+        'rps' => $n / max(1, $last - $first) * 1e9,
+        'p50' => $latencies[(int)floor(($n - 1) * 0.50)],
+        'p99' => $latencies[(int)floor(($n - 1) * 0.99)],
+    ];
+}
+
+/**
+ * Client process: warms up, then sends the requests over one connection and writes the start and end times
+ * followed by the latency of every request (all in ns, from the monotonic clock shared by all processes)
+ */
+function run_client(string $address, array $params, string $order, int $requests, int $seed, string $out): void
+{
+    mt_srand($seed);
+    $client = new FastCGIClient($address);
+    $n      = count($params);
+    $mine   = $seed % $n;
+
+    foreach ($params as $p) {
+        $client->request($p);
+    }
+
+    $latencies = [];
+    $start     = hrtime(true);
+    for ($i = 0; $i < $requests; ++$i) {
+        $p = $params['same' === $order ? $mine : mt_rand(0, $n - 1)];
+        $t = hrtime(true);
+        $client->request($p);
+        $latencies[] = hrtime(true) - $t;
+    }
+
+    $end = hrtime(true);
+    file_put_contents($out, pack('P*', $start, $end, ...$latencies));
+}
+
+/**
+ * @return int[] VmRSS of the children of $pid, in KiB
+ */
+function workers_rss(int $pid): array
+{
+    $rss = [];
+    foreach (glob('/proc/[0-9]*/stat') as $file) {
+        $stat = (string)@file_get_contents($file);
+        /* The command name may contain spaces, the fields after it may not */
+        $fields = explode(' ', substr($stat, (int)strrpos($stat, ')') + 2));
+        if (isset($fields[1]) && (int)$fields[1] === $pid) {
+            $status = (string)@file_get_contents(dirname($file) . '/status');
+            if (preg_match('/^VmRSS:\s+(\d+)/m', $status, $m)) {
+                $rss[] = (int)$m[1];
+            }
+        }
+    }
+
+    return $rss;
+}
@@ -0,0 +1,133 @@
+<?php
+/**
+ * Measures what chuid adds to a request: runs requests back to back through a single php-cgi FastCGI worker
+ * (so that every request goes through chuid_zend_activate(), get_docroot_guids(), the auto global hooks
+ * and deactivate()) and compares the time per request with chuid disabled.
+ *
+ * Usage: php microbench.php --cgi=/path/to/php-cgi --extension=/path/to/chuid.so [--fpm=/path/to/php-fpm] [--requests=N] [--docroots=N]
+ *
+ * Must be run as root. If strace is available, the number of system calls per request is reported as well.
+ * The requests go to all document roots in turn, except for the configurations which send every request
+ * to the same document root (the best case for chuid.defer_restore), and those which omit DOCUMENT_ROOT.
+ * php-cgi finds everything it has in getenv(), so without DOCUMENT_ROOT chuid goes straight to the defaults;
+ * with --fpm, the same requests go through a php-fpm worker as well, where chuid falls back to
+ * register_server_variables() and the input filter keeps the FastCGI parameters out of the temporary array.
+ * The overhead is relative to the first configuration of the same SAPI.
+ * Note that chuid always uses setresuid()/setresgid() under FastCGI; setuid()/setgid() are only used by CLI/CGI,
+ * which serve one request per process.
+ */
+
+require __DIR__ . '/fcgi.inc';
+
+$opts = getopt('', ['cgi:', 'extension:', 'fpm::', 'requests::', 'docroots::']) + [
+    'cgi'       => 'php-cgi',
+    'fpm'       => '',
+    'extension' => __DIR__ . '/../modules/chuid.so',
+    'requests'  => 20000,
+    'docroots'  => 16,
+];
+
+skip_unless_root();
+
+$requests = max(1, (int)$opts['requests']);
+$base     = sys_get_temp_dir() . '/chuid-bench-' . getmypid();
+$jail     = $base . '/jail';
+$socket   = $base . '/php.sock';
+$roots    = make_docroots($jail, max(1, (int)$opts['docroots']));
+$strace   = trim((string)shell_exec('command -v strace 2>/dev/null'));
+
+/* Configuration => [INI settings, which requests to send: 'all' document roots, the 'same' one or 'no docroot', SAPI] */
+$configs = [
+    'chuid disabled'               => [['chuid.enabled' => 0], 'all', 'cgi'],
+    'setresxid'                    => [[], 'all', 'cgi'],
+    'setresuid (no_set_gid)'       => [['chuid.no_set_gid' => 1], 'all', 'cgi'],
+    'setresxid, docroot cache'     => [['chuid.docroot_cache_ttl' => 60], 'all', 'cgi'],
+    'setresxid, defer_restore'     => [['chuid.docroot_cache_ttl' => 60, 'chuid.defer_restore' => 1, 'cgi.fix_pathinfo' => 0], 'all', 'cgi'],
+    'defer_restore, same tenant'   => [['chuid.docroot_cache_ttl' => 60, 'chuid.defer_restore' => 1, 'cgi.fix_pathinfo' => 0], 'same', 'cgi'],
+    'setresxid, no DOCUMENT_ROOT'  => [['chuid.warning_interval' => 3600], 'no docroot', 'cgi'],
+    'per-request chroot'           => [['chuid.enable_per_request_chroot' => 1, 'chuid.chroot_to' => $jail], 'all', 'cgi'],
+    'per-request chroot, fd cache' => [['chuid.enable_per_request_chroot' => 1, 'chuid.chroot_to' => $jail, 'chuid.chroot_fd_cache_size' => 64, 'chuid.docroot_cache_ttl' => 60], 'all', 'cgi'],
+    'fpm: chuid disabled'          => [['chuid.enabled' => 0], 'all', 'fpm'],
+    'fpm: setresxid'               => [[], 'all', 'fpm'],
+    'fpm: no DOCUMENT_ROOT'        => [['chuid.warning_interval' => 3600], 'no docroot', 'fpm'],
+];
+
+if (!$opts['fpm']) {
+    $configs = array_filter($configs, function (array $config): bool {
+        return 'fpm' !== $config[2];
+    });
+}
+
+printf("%d requests over %d document roots\n\n", $requests, count($roots));
+printf("%-32s %14s %14s %14s\n", 'Configuration', 'ns/request', 'overhead, ns', 'syscalls/req');
+
+$baseline = [];
+try {
+    foreach ($configs as $name => [$ini, $mode, $sapi]) {
+        $ini += ['chuid.enabled' => 1, 'chuid.never_root' => 1, 'error_log' => '/dev/null'];
+        if ('fpm' === $sapi) {
+            [$proc, $pid, $address] = start_php_fpm($opts['fpm'], $opts['extension'], $ini, $socket);
+        }
+        else {
+            [$proc, $pid, $address] = start_php_cgi($opts['cgi'], $opts['extension'], $ini, $socket);
+        }
+
+        try {
+            $client = new FastCGIClient($address);
+            $params = [];
+            foreach ('same' === $mode ? [$roots[0]] : $roots as $root) {
+                $p = fcgi_params($root);
+                if ('no docroot' === $mode) {
+                    unset($p['DOCUMENT_ROOT']);
+                }
+
+                $params[] = $p;
+            }
+
+            /* Warm up */
+            foreach ($params as $p) {
+                $client->request($p);
+            }
+
+            $n     = count($params);
+            $start = hrtime(true);
+            for ($i = 0; $i < $requests; ++$i) {
+                $client->request($params[$i % $n]);
+            }
+
+            $ns = (hrtime(true) - $start) / $requests;
+
+            $syscalls = '-';
+            if ($strace) {
+                $out = $base . '/strace.txt';
+                $st  = proc_open([$strace, '-c', '-o', $out, '-p', (string)$pid], [1 => ['file', '/dev/null', 'w'], 2 => ['file', '/dev/null', 'w']], $pipes);
+                usleep(200000);
+                $count = min($requests, 2000);
+                for ($i = 0; $i < $count; ++$i) {
+                    $client->request($params[$i % $n]);
+                }
+
+                proc_terminate($st, 2); /* SIGINT */
+                proc_close($st);
+                $calls = strace_total_calls((string)@file_get_contents($out));
+                if (null !== $calls) {
+                    $syscalls = sprintf('%.1f', $calls / $count);
+                }
+            }
+
+            unset($client);
+        }
+        finally {
+            stop_php_cgi($proc);
+        }
+
+        if (!isset($baseline[$sapi])) {
+            $baseline[$sapi] = $ns;
+        }
+
+        printf("%-32s %14.0f %14.0f %14s\n", $name, $ns, $ns - $baseline[$sapi], $syscalls);
+    }
+}
+finally {
+    rrmdir($base);
+}
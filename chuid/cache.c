@@ -0,0 +1,140 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-process DOCUMENT_ROOT owner cache — implementation
+ */
+
+#include <time.h>
+#include "cache.h"
+#include "shmcache.h"
+#include "metrics.h"
+
+/**
+ * @brief Cache entry
+ */
+typedef struct _docroot_cache_entry {
+	time_t expires; /**< When the entry expires */
+	uid_t uid;      /**< Owner UID */
+	gid_t gid;      /**< Owner GID */
+	int error;      /**< @c errno of the failed @c stat(), 0 if there was no error */
+} docroot_cache_entry;
+
+/**
+ * @brief Cache entry destructor
+ * @param zv Entry to destroy
+ */
+static void docroot_cache_dtor(zval* zv)
+{
+	pefree(Z_PTR_P(zv), 1);
+}
+
+/**
+ * The entries are evicted in the order they were added
+ */
+int cache_make_room(HashTable* ht, long int limit)
+{
+	if (limit > 0 && zend_hash_num_elements(ht) >= (uint32_t)limit) {
+		HashPosition pos;
+		zend_string* key;
+		zend_ulong idx;
+
+		zend_hash_internal_pointer_reset_ex(ht, &pos);
+		if (HASH_KEY_IS_STRING == zend_hash_get_current_key_ex(ht, &key, &idx, &pos)) {
+			zend_hash_del(ht, key);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void docroot_cache_init(HashTable* ht)
+{
+	zend_hash_init(ht, 16, NULL, docroot_cache_dtor, 1);
+}
+
+void docroot_cache_destroy(HashTable* ht)
+{
+	zend_hash_destroy(ht);
+}
+
+/**
+ * @brief Stores the entry in the per-process cache
+ * @param docroot Document root
+ * @param len Length of @c docroot
+ * @param entry Entry to store
+ */
+static void add_local(const char* docroot, size_t len, const docroot_cache_entry* entry)
+{
+	HashTable* ht = &CHUID_G(docroot_cache);
+
+	if (!zend_hash_str_exists(ht, docroot, len) && cache_make_room(ht, CHUID_G(docroot_cache_size))) {
+		++CHUID_G(docroot_cache_evictions);
+	}
+
+	zend_hash_str_update_mem(ht, docroot, len, (void*)entry, sizeof(*entry));
+}
+
+/**
+ * If the entry is not in the per-process cache, the cache shared between the workers is consulted.
+ */
+int docroot_cache_find(const char* docroot, size_t len, uid_t* uid, gid_t* gid, int* error)
+{
+	docroot_cache_entry* entry;
+	docroot_cache_entry shared;
+
+	if (CHUID_G(docroot_cache_ttl) <= 0) {
+		return FAILURE;
+	}
+
+	entry = zend_hash_str_find_ptr(&CHUID_G(docroot_cache), docroot, len);
+	if (entry) {
+		if (entry->expires > time(NULL)) {
+			*uid   = entry->uid;
+			*gid   = entry->gid;
+			*error = entry->error;
+			++CHUID_G(docroot_cache_hits);
+			metrics_inc(cmt_cache_hits);
+			return SUCCESS;
+		}
+
+		zend_hash_str_del(&CHUID_G(docroot_cache), docroot, len);
+	}
+
+	if (SUCCESS == shm_cache_find(docroot, len, &shared.uid, &shared.gid, &shared.error, &shared.expires)) {
+		add_local(docroot, len, &shared);
+		*uid   = shared.uid;
+		*gid   = shared.gid;
+		*error = shared.error;
+		++CHUID_G(docroot_cache_shm_hits);
+		metrics_inc(cmt_cache_hits);
+		return SUCCESS;
+	}
+
+	++CHUID_G(docroot_cache_misses);
+	return FAILURE;
+}
+
+/**
+ * When the per-process cache is full, its oldest entry gets evicted.
+ * The shared cache is only written with full privileges.
+ */
+void docroot_cache_add(const char* docroot, size_t len, uid_t uid, gid_t gid, int error)
+{
+	docroot_cache_entry entry;
+
+	if (CHUID_G(docroot_cache_ttl) <= 0) {
+		return;
+	}
+
+	entry.expires = time(NULL) + CHUID_G(docroot_cache_ttl);
+	entry.uid     = uid;
+	entry.gid     = gid;
+	entry.error   = error;
+
+	add_local(docroot, len, &entry);
+	if (!CHUID_G(switched)) {
+		shm_cache_add(docroot, len, uid, gid, error, entry.expires);
+	}
+}
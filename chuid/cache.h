@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-process DOCUMENT_ROOT owner cache — definitions
+ */
+
+#ifndef PHPCHUID_CACHE_H_
+#define PHPCHUID_CACHE_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Evicts the oldest entry from the cache if the cache has reached @c limit entries
+ * @param ht Cache
+ * @param limit Maximum number of entries; 0 means no limit
+ * @return Whether an entry has been evicted
+ */
+PHPCHUID_VISIBILITY_HIDDEN int cache_make_room(HashTable* ht, long int limit);
+
+/**
+ * @brief Initializes the DOCUMENT_ROOT cache
+ * @param ht Hash table to initialize
+ */
+PHPCHUID_VISIBILITY_HIDDEN void docroot_cache_init(HashTable* ht);
+
+/**
+ * @brief Destroys the DOCUMENT_ROOT cache
+ * @param ht Hash table to destroy
+ */
+PHPCHUID_VISIBILITY_HIDDEN void docroot_cache_destroy(HashTable* ht);
+
+/**
+ * @brief Looks up the owner of the @c DOCUMENT_ROOT in the cache
+ * @param docroot Document root
+ * @param len Length of @c docroot
+ * @param uid [out] Cached UID
+ * @param gid [out] Cached GID
+ * @param error [out] Cached @c errno of the failed @c stat(), 0 if @c stat() succeeded
+ * @return Whether the entry has been found
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the cache is disabled, the entry is missing or has expired)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int docroot_cache_find(const char* docroot, size_t len, uid_t* uid, gid_t* gid, int* error);
+
+/**
+ * @brief Stores the owner of the @c DOCUMENT_ROOT in the cache
+ * @param docroot Document root
+ * @param len Length of @c docroot
+ * @param uid UID (already adjusted for @c chuid.never_root)
+ * @param gid GID (already adjusted for @c chuid.never_root)
+ * @param error @c errno of the failed @c stat(), 0 if @c stat() succeeded
+ */
+PHPCHUID_VISIBILITY_HIDDEN void docroot_cache_add(const char* docroot, size_t len, uid_t uid, gid_t gid, int error);
+
+#endif /* PHPCHUID_CACHE_H_ */
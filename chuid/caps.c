@@ -115,3 +115,53 @@ int drop_capabilities_except(int num_caps, cap_value_t* cap_list)
 
 	return retval;
 }
+
+/**
+ * @c libcap-ng keeps the state per thread: it is read from the kernel first, so that the other sets stay as they are
+ */
+int set_effective_capabilities(int num_caps, cap_value_t* cap_list, int raise)
+{
+	int retval = 0;
+#if defined(WITH_CAP_LIBRARY)
+	cap_t capabilities;
+#endif
+
+	assert(cap_list != NULL);
+
+#if defined(WITH_CAP_LIBRARY)
+	capabilities = cap_get_proc();
+	if (NULL != capabilities) {
+		if (-1 == cap_set_flag(capabilities, CAP_EFFECTIVE, num_caps, cap_list, raise ? CAP_SET : CAP_CLEAR) || -1 == cap_set_proc(capabilities)) {
+			retval = -1;
+		}
+
+		cap_free(capabilities);
+	}
+	else {
+		retval = -1;
+	}
+#elif defined(WITH_CAPNG_LIBRARY)
+	if (0 == capng_get_caps_process()) {
+		int i;
+
+		for (i=0; i<num_caps; ++i) {
+			capng_update(raise ? CAPNG_ADD : CAPNG_DROP, CAPNG_EFFECTIVE, cap_list[i]);
+		}
+
+		if (capng_apply(CAPNG_SELECT_CAPS) < 0) {
+			errno  = EPERM;
+			retval = -1;
+		}
+	}
+	else {
+		retval = -1;
+	}
+#else
+	(void)num_caps;
+	(void)raise;
+	errno  = ENOSYS;
+	retval = -1;
+#endif
+
+	return retval;
+}
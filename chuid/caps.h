@@ -40,4 +40,16 @@ PHPCHUID_VISIBILITY_HIDDEN int check_capabilities(int* restrict sys_chroot_, int
  */
 PHPCHUID_VISIBILITY_HIDDEN int drop_capabilities_except(int num_caps, cap_value_t* cap_list);
 
+/**
+ * @brief Raises or lowers the capabilities in @c cap_list in the @c EFFECTIVE set; the @c PERMITTED set is not changed
+ * @param num_caps Number of capabilities in @c cap_list
+ * @param cap_list List of the capabilities; must not be @c NULL
+ * @param raise Whether to raise (non-zero) or to lower (0) the capabilities
+ * @return Whether the call was successful
+ * @retval 0 Yes
+ * @retval -1 No (@c errno will be set; @c ENOSYS if chuid is built without @c libcap and @c libcap-ng)
+ * @note Only the capabilities of the calling thread are changed
+ */
+PHPCHUID_VISIBILITY_HIDDEN int set_effective_capabilities(int num_caps, cap_value_t* cap_list, int raise);
+
 #endif /* PHPCHUID_CAPS_H_ */
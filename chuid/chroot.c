@@ -0,0 +1,711 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-request chroot helpers — implementation
+ */
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <Zend/zend_smart_str.h>
+#include "chroot.h"
+#include "cache.h"
+#include "helpers.h"
+#include "probes.h"
+#include "stats.h"
+
+/**
+ * @brief Name of the INI setting resolved by @c resolve_req_chroot()
+ */
+#define CHROOT_TO_INI "chuid.chroot_to"
+
+/**
+ * @brief Original callback of the @c $_SERVER auto global
+ */
+static zend_auto_global_callback orig_server_callback = NULL;
+
+/**
+ * @brief Original callback of the @c $_ENV auto global
+ */
+static zend_auto_global_callback orig_env_callback = NULL;
+
+/**
+ * @brief Names of the variables to adjust for the per-request @c chroot (from @c chuid.chroot_rewrite_vars)
+ */
+static zend_string** rewrite_vars = NULL;
+
+/**
+ * @brief Number of elements in @c rewrite_vars
+ */
+static size_t num_rewrite_vars = 0;
+
+/**
+ * @brief Cache entry
+ */
+typedef struct _chroot_cache_entry {
+	time_t expires;    /**< When the entry expires */
+	zend_string* root; /**< Value of @c chuid.chroot_to, @c NULL if it is empty */
+} chroot_cache_entry;
+
+/**
+ * @brief Cache entry destructor
+ * @param zv Entry to destroy
+ */
+static void chroot_cache_dtor(zval* zv)
+{
+	chroot_cache_entry* entry = Z_PTR_P(zv);
+
+	if (entry->root) {
+		zend_string_release(entry->root);
+	}
+
+	pefree(entry, 1);
+}
+
+/**
+ * @brief Jail descriptor cache entry
+ */
+typedef struct _jail_fd_entry {
+	int fd;         /**< Descriptor of the jail directory */
+	time_t checked; /**< When the path was last checked to still lead to the directory */
+	dev_t dev;      /**< Device of the directory */
+	ino_t ino;      /**< Inode of the directory */
+} jail_fd_entry;
+
+/**
+ * @brief Destructor for the values of the parsed user INI file
+ * @param zv Value to destroy
+ * @see config_zval_dtor() in main/php_ini.c
+ */
+static void user_ini_dtor(zval* zv)
+{
+	if (IS_ARRAY == Z_TYPE_P(zv)) {
+		zend_hash_destroy(Z_ARRVAL_P(zv));
+		free(Z_ARR_P(zv));
+	}
+	else if (IS_STRING == Z_TYPE_P(zv)) {
+		zend_string_release(Z_STR_P(zv));
+	}
+}
+
+/**
+ * @brief Jail descriptor destructor
+ * @param zv Entry to destroy
+ */
+static void jail_fd_dtor(zval* zv)
+{
+	jail_fd_entry* entry = Z_PTR_P(zv);
+
+	close(entry->fd);
+	pefree(entry, 1);
+}
+
+void chroot_cache_init(HashTable* ht)
+{
+	zend_hash_init(ht, 16, NULL, chroot_cache_dtor, 1);
+}
+
+void chroot_cache_destroy(HashTable* ht)
+{
+	zend_hash_destroy(ht);
+}
+
+void jail_fd_cache_init(HashTable* ht)
+{
+	zend_hash_init(ht, 16, NULL, jail_fd_dtor, 1);
+}
+
+void jail_fd_cache_destroy(HashTable* ht)
+{
+	zend_hash_destroy(ht);
+}
+
+/**
+ * @brief Gets the cached descriptor of the jail, opening it if it is not cached
+ * @param root Jail directory
+ * @param len Length of @c root
+ * @return Descriptor (owned by the cache), -1 if the directory cannot be opened
+ *
+ * A descriptor whose directory has no links left (the jail has been removed) is reopened. Once
+ * @c chuid.chroot_fd_cache_ttl seconds have passed since the last check, the path is looked up again,
+ * and the descriptor is reopened if the path leads to another directory (the jail has been renamed or replaced).
+ */
+static int jail_fd(const char* root, size_t len)
+{
+	int fd;
+	struct stat st;
+	jail_fd_entry entry;
+	jail_fd_entry* cached;
+	time_t now     = time(NULL);
+	HashTable* fds = &CHUID_G(jail_fds);
+
+	cached = zend_hash_str_find_ptr(fds, root, len);
+	if (cached) {
+		if (0 == fstat(cached->fd, &st) && 0 != st.st_nlink) {
+			if (cached->checked + CHUID_G(jail_fd_cache_ttl) > now) {
+				return cached->fd;
+			}
+
+			if (0 == stat(root, &st) && st.st_dev == cached->dev && st.st_ino == cached->ino) {
+				cached->checked = now;
+				return cached->fd;
+			}
+		}
+
+		zend_hash_str_del(fds, root, len);
+	}
+
+	fd = open(
+		root,
+		O_DIRECTORY
+#ifdef O_CLOEXEC
+		| O_CLOEXEC
+#endif
+#ifdef O_PATH
+		| O_PATH
+#else
+		| O_RDONLY
+#endif
+	);
+
+	if (-1 != fd) {
+		if (0 != fstat(fd, &st)) {
+			close(fd);
+			return -1;
+		}
+
+		entry.fd      = fd;
+		entry.checked = now;
+		entry.dev     = st.st_dev;
+		entry.ino     = st.st_ino;
+
+		cache_make_room(fds, CHUID_G(jail_fd_cache_size));
+		zend_hash_str_update_mem(fds, root, len, &entry, sizeof(entry));
+	}
+
+	return fd;
+}
+
+/**
+ * If the descriptor cannot be opened, falls back to @c do_chroot().
+ */
+int enter_jail(const char* root, size_t len)
+{
+	int fd;
+
+	if (CHUID_G(jail_fd_cache_size) <= 0) {
+		return do_chroot(root);
+	}
+
+	fd = jail_fd(root, len);
+	if (-1 == fd) {
+		return do_chroot(root);
+	}
+
+	if (0 != fchdir(fd)) {
+		PHPCHUID_ERROR(E_CORE_ERROR, "fchdir(\"%s\"): %s", root, strerror(errno));
+		CHUID_PROBE2(chroot, root, -1);
+		return FAILURE;
+	}
+
+	if (0 != chroot(".")) {
+		PHPCHUID_ERROR(E_CORE_ERROR, "chroot(\"%s\"): %s", root, strerror(errno));
+		CHUID_PROBE2(chroot, root, -1);
+		return FAILURE;
+	}
+
+	CHUID_PROBE2(chroot, root, 0);
+	return SUCCESS;
+}
+
+/**
+ * The root directory is compared with the entry of the descriptor cache. Once @c chuid.chroot_fd_cache_ttl seconds
+ * have passed since the entry was checked (on every request if the descriptor cache is disabled), @c root is looked up
+ * on the real file system, relative to the descriptor of the real root, so that a renamed or replaced jail is noticed.
+ * When in doubt (e.g., the path contains an absolute symbolic link, which resolves inside the jail), the jail is
+ * reported as not current and the caller enters it anew.
+ */
+int jail_is_current(const char* root, size_t len)
+{
+	struct stat here;
+	struct stat there;
+	jail_fd_entry* cached = zend_hash_str_find_ptr(&CHUID_G(jail_fds), root, len);
+	time_t now            = time(NULL);
+
+	if (0 != stat("/", &here)) {
+		return 0;
+	}
+
+	if (cached) {
+		if (here.st_dev != cached->dev || here.st_ino != cached->ino) {
+			return 0;
+		}
+
+		if (cached->checked + CHUID_G(jail_fd_cache_ttl) > now) {
+			return 1;
+		}
+	}
+
+	if (0 != fstatat(CHUID_G(root_fd), root[1] ? root + 1 : ".", &there, 0) || here.st_dev != there.st_dev || here.st_ino != there.st_ino) {
+		return 0;
+	}
+
+	if (cached) {
+		cached->checked = now;
+	}
+
+	return 1;
+}
+
+int prewarm_jail(const char* root, size_t len)
+{
+	if (CHUID_G(jail_fd_cache_size) <= 0) {
+		return FAILURE;
+	}
+
+	return -1 != jail_fd(root, len) ? SUCCESS : FAILURE;
+}
+
+/**
+ * The process gets back to the original root through the descriptor opened in MINIT, which is outside of any jail
+ */
+int leave_jail(int severity)
+{
+	int res;
+
+	CHUID_G(in_jail) = 0;
+
+	res = fchdir(CHUID_G(root_fd));
+	if (res) {
+		PHPCHUID_ERROR(severity, "fchdir() failed: %s", strerror(errno));
+		return res;
+	}
+
+	res = chroot(".");
+	if (res) {
+		PHPCHUID_ERROR(severity, "chroot(\".\") failed: %s", strerror(errno));
+	}
+
+	return res;
+}
+
+/**
+ * @brief Looks up @c chuid.chroot_to in the given section of @c php.ini
+ * @param name Section name (path or host name)
+ * @param len Length of @c name
+ * @param value Current value
+ * @return New value if the section sets @c chuid.chroot_to, @c value otherwise
+ */
+static zend_string* find_in_section(const char* name, size_t len, zend_string* value)
+{
+	zval* section = zend_hash_str_find(php_ini_get_configuration_hash(), name, len);
+
+	if (section && IS_ARRAY == Z_TYPE_P(section)) {
+		zval* v = zend_hash_str_find(Z_ARRVAL_P(section), ZEND_STRL(CHROOT_TO_INI));
+		if (v && IS_STRING == Z_TYPE_P(v)) {
+			return Z_STR_P(v);
+		}
+	}
+
+	return value;
+}
+
+/**
+ * @brief Looks up @c chuid.chroot_to in the user INI file in @c dir
+ * @param dir Directory
+ * @param value [in,out] Current value; replaced with a copy of the value from the file
+ */
+static void find_in_user_ini(const char* dir, zend_string** value)
+{
+	HashTable config;
+
+	zend_hash_init(&config, 8, NULL, user_ini_dtor, 1);
+	if (SUCCESS == php_parse_user_ini_file(dir, PG(user_ini_filename), &config)) {
+		zval* v = zend_hash_str_find(&config, ZEND_STRL(CHROOT_TO_INI));
+		if (v && IS_STRING == Z_TYPE_P(v)) {
+			if (*value) {
+				zend_string_release(*value);
+			}
+
+			*value = zend_string_init(Z_STRVAL_P(v), Z_STRLEN_P(v), 0);
+		}
+	}
+
+	zend_hash_destroy(&config);
+}
+
+/**
+ * @brief Computes @c chuid.chroot_to the way the CGI SAPI applies per-host, per-directory and user INI settings
+ * @param host Lowercase @c SERVER_NAME, may be @c NULL
+ * @param host_len Length of @c host
+ * @param docroot @c DOCUMENT_ROOT without the trailing slash, may be @c NULL
+ * @param docroot_len Length of @c docroot
+ * @param dir Directory of the script with the trailing slash; gets modified but restored before return
+ * @param dir_len Length of @c dir
+ * @return Persistent string with the value, @c NULL if the value is empty or relative
+ * @see sapi_cgi_activate() and php_cgi_ini_activate_user_config() in sapi/cgi/cgi_main.c
+ */
+static zend_string* compute_req_chroot(const char* host, size_t host_len, const char* docroot, size_t docroot_len, char* dir, size_t dir_len)
+{
+	char* ptr;
+	size_t len;
+	zend_string* result;
+	zend_string* value     = NULL;
+	zend_string* user_val  = NULL;
+	const char* system_val = CHUID_G(req_chroot);
+
+	if (host) {
+		/* host is not NUL-terminated (it is a part of the cache key) */
+		value = find_in_section(host, host_len, value);
+	}
+
+	ptr = dir + 1;
+	while ((ptr = strchr(ptr, '/')) != NULL) {
+		*ptr  = 0;
+		value = find_in_section(dir, (size_t)(ptr - dir), value);
+		*ptr  = '/';
+		++ptr;
+	}
+
+	if (PG(user_ini_filename) && *PG(user_ini_filename)) {
+		if (docroot && dir_len > docroot_len && !strncmp(docroot, dir, docroot_len)) {
+			/* Every directory from DOCUMENT_ROOT down to the directory of the script */
+			ptr = dir + docroot_len;
+			while ((ptr = strchr(ptr, '/')) != NULL) {
+				*ptr = 0;
+				find_in_user_ini(dir, &user_val);
+				*ptr = '/';
+				++ptr;
+			}
+		}
+		else {
+			find_in_user_ini(dir, &user_val);
+		}
+	}
+
+	if (user_val) {
+		ptr = ZSTR_VAL(user_val);
+		len = ZSTR_LEN(user_val);
+	}
+	else if (value) {
+		ptr = ZSTR_VAL(value);
+		len = ZSTR_LEN(value);
+	}
+	else {
+		ptr = (char*)system_val;
+		len = ptr ? strlen(ptr) : 0;
+	}
+
+	result = (len && '/' == *ptr) ? zend_string_init(ptr, len, 1) : NULL;
+
+	if (user_val) {
+		zend_string_release(user_val);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Gets the value of @c chuid.chroot_to for the directory, from the cache if possible
+ * @param host @c SERVER_NAME, may be @c NULL
+ * @param docroot @c DOCUMENT_ROOT, may be @c NULL
+ * @param path Path to the script, or to the directory itself if @c is_dir is set
+ * @param is_dir Whether @c path is a directory
+ * @return Per-request root directory (owned by the cache), @c NULL if not set
+ *
+ * The result depends on @c SERVER_NAME, @c DOCUMENT_ROOT and the directory of the script, and is cached
+ * for @c user_ini.cache_ttl seconds, just like the CGI SAPI caches the user INI files.
+ */
+static zend_string* lookup_req_chroot(const char* host, const char* docroot, const char* path, zend_bool is_dir)
+{
+	size_t host_len;
+	size_t docroot_len;
+	size_t path_len;
+	size_t dir_len;
+	size_t prefix_len;
+	char* dir;
+	smart_str key = { 0 };
+	chroot_cache_entry entry;
+	chroot_cache_entry* cached;
+	time_t now;
+
+	if (!path || !*path) {
+		return NULL;
+	}
+
+	host_len    = host    ? strlen(host)    : 0;
+	docroot_len = docroot ? strlen(docroot) : 0;
+	path_len    = strlen(path);
+
+	if (docroot_len > 0 && '/' == docroot[docroot_len-1]) {
+		--docroot_len;
+	}
+
+	/* Key: "host\ndocroot\ndir/"; the host name is lowercased just like sapi_cgi_activate() does */
+	smart_str_appendl(&key, host ? host : "", host_len);
+	zend_str_tolower(ZSTR_VAL(key.s), host_len);
+	smart_str_appendc(&key, '\n');
+	smart_str_appendl(&key, docroot ? docroot : "", docroot_len);
+	smart_str_appendc(&key, '\n');
+	prefix_len = ZSTR_LEN(key.s);
+
+	/* Reserve room for the trailing slash */
+	smart_str_appendl(&key, path, path_len);
+	smart_str_appendc(&key, '/');
+	smart_str_0(&key);
+
+	dir     = ZSTR_VAL(key.s) + prefix_len;
+	dir_len = is_dir ? path_len : zend_dirname(dir, path_len);
+	if ('/' != dir[dir_len-1]) {
+		dir[dir_len++] = '/';
+	}
+
+	dir[dir_len]      = 0;
+	ZSTR_LEN(key.s) = prefix_len + dir_len;
+
+	now    = time(NULL);
+	cached = zend_hash_str_find_ptr(&CHUID_G(chroot_cache), ZSTR_VAL(key.s), ZSTR_LEN(key.s));
+	if (cached && cached->expires > now) {
+		smart_str_free(&key);
+		return cached->root;
+	}
+
+	if (CHUID_G(in_jail) && PG(user_ini_filename) && *PG(user_ini_filename)) {
+		/* The user INI files are on the real file system */
+		leave_jail(E_CORE_ERROR);
+	}
+
+	entry.expires = now + PG(user_ini_cache_ttl);
+	entry.root    = compute_req_chroot(
+		host_len    ? ZSTR_VAL(key.s)     : NULL, host_len,
+		docroot_len ? docroot             : NULL, docroot_len,
+		dir, dir_len
+	);
+
+	if (!cached) {
+		cache_make_room(&CHUID_G(chroot_cache), CHUID_G(chroot_cache_size));
+	}
+
+	zend_hash_str_update_mem(&CHUID_G(chroot_cache), ZSTR_VAL(key.s), ZSTR_LEN(key.s), &entry, sizeof(entry));
+	smart_str_free(&key);
+	return entry.root;
+}
+
+/**
+ * FPM applies these values before the request starts, and the INI settings they lock cannot be changed by the user INI files.
+ */
+int req_has_ini_values(void)
+{
+	return
+		   sapi_is_fpm
+		&& sapi_module.getenv
+		&& (sapi_module.getenv(ZEND_STRL("PHP_VALUE")) || sapi_module.getenv(ZEND_STRL("PHP_ADMIN_VALUE")))
+	;
+}
+
+zend_string* resolve_req_chroot(void)
+{
+	const char* path = SG(request_info).path_translated;
+	char* host       = sapi_module.getenv ? sapi_module.getenv(ZEND_STRL("SERVER_NAME"))   : NULL;
+	char* docroot    = sapi_module.getenv ? sapi_module.getenv(ZEND_STRL("DOCUMENT_ROOT")) : NULL;
+
+	return lookup_req_chroot(host, docroot, path, 0);
+}
+
+/**
+ * Only the scripts directly in the document root (front controllers such as @c index.php) share this entry:
+ * the value may differ in every directory below it.
+ */
+zend_string* prewarm_req_chroot(const char* host, const char* docroot)
+{
+	return lookup_req_chroot(host, docroot, docroot, 1);
+}
+
+/**
+ * The root matches only whole path components: @c /srv/jail is not a prefix of @c /srv/jail2/x
+ */
+size_t jail_prefix_len(const char* path, size_t len)
+{
+	zend_string* jail = CHUID_G(jail);
+	size_t jlen       = ZSTR_LEN(jail);
+
+	return (len >= jlen && !memcmp(path, ZSTR_VAL(jail), jlen) && (len == jlen || '/' == path[jlen])) ? jlen : 0;
+}
+
+/**
+ * @brief Strips the root of the current request from the path in @c var
+ * @param var Variable to modify
+ */
+static void strip_jail(zval* var)
+{
+	size_t len;
+
+	if (IS_STRING == Z_TYPE_P(var) && 0 != (len = jail_prefix_len(Z_STRVAL_P(var), Z_STRLEN_P(var)))) {
+		if (Z_REFCOUNTED_P(var) && 1 == Z_REFCOUNT_P(var)) {
+			memmove(Z_STRVAL_P(var), Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len+1);
+			Z_STRLEN_P(var) -= len;
+			zend_string_forget_hash_val(Z_STR_P(var));
+		}
+		else {
+			zend_string* s = zend_string_init(Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len, 0);
+			zval_ptr_dtor(var);
+			ZVAL_STR(var, s);
+		}
+	}
+}
+
+/**
+ * @brief Strips the root of the current request from the variables listed in @c chuid.chroot_rewrite_vars
+ * @param arr @c $_SERVER or @c $_ENV
+ */
+static void strip_jail_from_vars(zval* arr)
+{
+	if (IS_ARRAY == Z_TYPE_P(arr)) {
+		size_t i;
+
+		for (i=0; i<num_rewrite_vars; ++i) {
+			zval* var = zend_hash_find(Z_ARRVAL_P(arr), rewrite_vars[i]);
+			if (var) {
+				strip_jail(var);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Creates @c $_SERVER and adjusts it for the per-request @c chroot
+ * @param name Auto global name
+ * @return Whether the auto global needs to be re-armed
+ */
+static zend_bool chuid_create_server(zend_string* name)
+{
+	zend_bool res = orig_server_callback(name);
+
+	if (CHUID_G(chrooted)) {
+		uint64_t start = stats_start();
+
+		strip_jail_from_vars(&PG(http_globals)[TRACK_VARS_SERVER]);
+		stats_stop(cph_rewrite, start);
+	}
+
+	return res;
+}
+
+/**
+ * @brief Creates @c $_ENV and adjusts it for the per-request @c chroot
+ * @param name Auto global name
+ * @return Whether the auto global needs to be re-armed
+ */
+static zend_bool chuid_create_env(zend_string* name)
+{
+	zend_bool res = orig_env_callback(name);
+
+	if (CHUID_G(chrooted)) {
+		uint64_t start = stats_start();
+
+		strip_jail_from_vars(&PG(http_globals)[TRACK_VARS_ENV]);
+		stats_stop(cph_rewrite, start);
+	}
+
+	return res;
+}
+
+/**
+ * The names are separated by commas and/or whitespace; empty items and duplicates are skipped (a variable must be
+ * stripped only once). The keys are persistent strings with precomputed hashes, so that looking them up
+ * in @c $_SERVER / @c $_ENV costs neither allocations nor hashing.
+ */
+void compile_rewrite_vars(const char* list)
+{
+	static const char* separators = ", \t\r\n";
+	const char* p = list;
+
+	free_rewrite_vars();
+
+	while (p && *p) {
+		size_t len;
+
+		p  += strspn(p, separators);
+		len = strcspn(p, separators);
+		if (len) {
+			size_t i;
+			zend_string* key = zend_string_init(p, len, 1);
+
+			zend_string_hash_val(key);
+			for (i=0; i<num_rewrite_vars && !zend_string_equals(rewrite_vars[i], key); ++i) {
+			}
+
+			if (i < num_rewrite_vars) {
+				zend_string_release(key);
+			}
+			else {
+				rewrite_vars = perealloc(rewrite_vars, (num_rewrite_vars + 1) * sizeof(zend_string*), 1);
+				rewrite_vars[num_rewrite_vars++] = key;
+			}
+
+			p += len;
+		}
+	}
+}
+
+void free_rewrite_vars(void)
+{
+	size_t i;
+
+	for (i=0; i<num_rewrite_vars; ++i) {
+		zend_string_release(rewrite_vars[i]);
+	}
+
+	if (rewrite_vars) {
+		pefree(rewrite_vars, 1);
+	}
+
+	rewrite_vars     = NULL;
+	num_rewrite_vars = 0;
+}
+
+/**
+ * The arrays are adjusted when they are created: during request startup if @c auto_globals_jit is off,
+ * or when the script first uses them otherwise. Thus, the arrays the script never uses are never built.
+ */
+void hook_auto_globals(void)
+{
+	zend_auto_global* ag;
+
+	ag = zend_hash_str_find_ptr(CG(auto_globals), ZEND_STRL("_SERVER"));
+	if (ag && ag->auto_global_callback && !orig_server_callback) {
+		orig_server_callback     = ag->auto_global_callback;
+		ag->auto_global_callback = chuid_create_server;
+	}
+
+	ag = zend_hash_str_find_ptr(CG(auto_globals), ZEND_STRL("_ENV"));
+	if (ag && ag->auto_global_callback && !orig_env_callback) {
+		orig_env_callback        = ag->auto_global_callback;
+		ag->auto_global_callback = chuid_create_env;
+	}
+}
+
+void unhook_auto_globals(void)
+{
+	zend_auto_global* ag;
+
+	if (orig_server_callback) {
+		ag = zend_hash_str_find_ptr(CG(auto_globals), ZEND_STRL("_SERVER"));
+		if (ag) {
+			ag->auto_global_callback = orig_server_callback;
+		}
+
+		orig_server_callback = NULL;
+	}
+
+	if (orig_env_callback) {
+		ag = zend_hash_str_find_ptr(CG(auto_globals), ZEND_STRL("_ENV"));
+		if (ag) {
+			ag->auto_global_callback = orig_env_callback;
+		}
+
+		orig_env_callback = NULL;
+	}
+}
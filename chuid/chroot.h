@@ -0,0 +1,130 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-request chroot helpers — definitions
+ */
+
+#ifndef PHPCHUID_CHROOT_H_
+#define PHPCHUID_CHROOT_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Initializes the per-directory @c chuid.chroot_to cache
+ * @param ht Hash table to initialize
+ */
+PHPCHUID_VISIBILITY_HIDDEN void chroot_cache_init(HashTable* ht);
+
+/**
+ * @brief Destroys the per-directory @c chuid.chroot_to cache
+ * @param ht Hash table to destroy
+ */
+PHPCHUID_VISIBILITY_HIDDEN void chroot_cache_destroy(HashTable* ht);
+
+/**
+ * @brief Initializes the jail descriptor cache
+ * @param ht Hash table to initialize
+ */
+PHPCHUID_VISIBILITY_HIDDEN void jail_fd_cache_init(HashTable* ht);
+
+/**
+ * @brief Destroys the jail descriptor cache, closing all descriptors
+ * @param ht Hash table to destroy
+ */
+PHPCHUID_VISIBILITY_HIDDEN void jail_fd_cache_destroy(HashTable* ht);
+
+/**
+ * @brief <code>chroot()</code>'s to @c root using a cached descriptor of the directory
+ * @param root New root directory, must be absolute
+ * @param len Length of @c root
+ * @return Whether the operation was successful
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (@c fchdir() or @c chroot() failed)
+ * @see do_chroot()
+ */
+PHPCHUID_VISIBILITY_HIDDEN int enter_jail(const char* root, size_t len);
+
+/**
+ * @brief Opens the jail directory and puts its descriptor into the jail descriptor cache
+ * @param root Jail directory, must be absolute
+ * @param len Length of @c root
+ * @return Whether the descriptor is in the cache
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the cache is disabled or the directory cannot be opened)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int prewarm_jail(const char* root, size_t len);
+
+/**
+ * @brief Checks whether the process, left in the jail by the previous request (@c chuid.stay_in_jail), is still in @c root
+ * @param root Jail directory, must be absolute
+ * @param len Length of @c root
+ * @return Whether the current root directory is the directory @c root leads to
+ * @note Must be called inside the jail
+ */
+PHPCHUID_VISIBILITY_HIDDEN int jail_is_current(const char* root, size_t len);
+
+/**
+ * @brief Escapes the per-request @c chroot
+ * @param severity Severity of the error to report on failure
+ * @return Whether the operation was successful
+ * @retval 0 Yes
+ * @retval -1 No (@c fchdir() or @c chroot() failed)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int leave_jail(int severity);
+
+/**
+ * @brief Computes the value of @c chuid.chroot_to for the current request without activating the SAPI
+ * @return Per-request root directory (owned by the cache), @c NULL if not set
+ * @note Only for the SAPIs which take per-directory settings from @c [PATH=] / @c [HOST=] sections of @c php.ini
+ * and from user INI files (@c sapi_has_user_ini)
+ */
+PHPCHUID_VISIBILITY_HIDDEN zend_string* resolve_req_chroot(void);
+
+/**
+ * @brief Checks whether the web server has passed INI settings to FPM (@c PHP_VALUE / @c PHP_ADMIN_VALUE)
+ * @return Whether the request has them
+ * @note @c resolve_req_chroot() does not see these settings; such requests need SAPI Activate
+ */
+PHPCHUID_VISIBILITY_HIDDEN int req_has_ini_values(void);
+
+/**
+ * @brief Gets the length of the root of the current request at the beginning of the path
+ * @param path Path
+ * @param len Length of @c path
+ * @return Number of bytes to strip, 0 if the path is not in the root
+ * @note The root must have been set with @c set_jail()
+ */
+PHPCHUID_VISIBILITY_HIDDEN size_t jail_prefix_len(const char* path, size_t len);
+
+/**
+ * @brief Computes and caches the value of @c chuid.chroot_to for the scripts in the document root
+ * @param host @c SERVER_NAME, may be @c NULL
+ * @param docroot @c DOCUMENT_ROOT
+ * @return Per-request root directory (owned by the cache), @c NULL if not set
+ * @note Same restrictions as for @c resolve_req_chroot()
+ */
+PHPCHUID_VISIBILITY_HIDDEN zend_string* prewarm_req_chroot(const char* host, const char* docroot);
+
+/**
+ * @brief Compiles the list of the variables to adjust for the per-request @c chroot
+ * @param list Value of @c chuid.chroot_rewrite_vars
+ */
+PHPCHUID_VISIBILITY_HIDDEN void compile_rewrite_vars(const char* list);
+
+/**
+ * @brief Frees the list compiled by @c compile_rewrite_vars()
+ */
+PHPCHUID_VISIBILITY_HIDDEN void free_rewrite_vars(void);
+
+/**
+ * @brief Makes @c $_SERVER and @c $_ENV strip the per-request root from the variables listed in @c chuid.chroot_rewrite_vars
+ */
+PHPCHUID_VISIBILITY_HIDDEN void hook_auto_globals(void);
+
+/**
+ * @brief Reverts @c hook_auto_globals()
+ */
+PHPCHUID_VISIBILITY_HIDDEN void unhook_auto_globals(void);
+
+#endif /* PHPCHUID_CHROOT_H_ */
@@ -10,7 +10,19 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <grp.h>
 #include "caps.h"
+#include "cache.h"
+#include "chroot.h"
+#include "shmcache.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "rpcache.h"
+#include "mapfile.h"
+#include "vhosts.h"
+#include "groups.h"
+#include "prewarm.h"
+#include "stats.h"
 #include "helpers.h"
 #include "extension.h"
 
@@ -59,7 +71,33 @@ static PHP_INI_DISP(chuid_protected_displayer)
  * <TR><TH>@c chuid.global_chroot</TH><TD>@c string</TD><TD>@c chroot() to this location before processing the request</TD></TR>
  * <TR><TH>@c chuid.enable_per_request_chroot</TH><TD>@c bool</TD><TD>Whether to enable per-request @c chroot(). Disabled when @c chuid.global_chroot is set</TD></TR>
  * <TR><TH>@c chuid.chroot_to</TH><TD>@c string</TD><TD>Per-request chroot. Used only when @c chuid.enable_per_request_chroot is enabled</TD></TR>
- * <TR><TH>@c chuid.run_sapi_deactivate</TH><TD>@c bool</TD><TD>Whether to run SAPI deactivate function after calling SAPI activate to get per-directory settings</TD></TR>
+ * <TR><TH>@c chuid.stay_in_jail</TH><TD>@c bool</TD><TD>Do not escape the per-request @c chroot when the request finishes; the next request escapes it only if it needs a different root. Requires @c cgi.fix_pathinfo=0</TD></TR>
+ * <TR><TH>@c chuid.chroot_rewrite_vars</TH><TD>@c string</TD><TD>Comma-separated list of @c $_SERVER / @c $_ENV variables to strip the per-request root from</TD></TR>
+ * <TR><TH>@c chuid.run_sapi_deactivate</TH><TD>@c bool</TD><TD>Whether to run SAPI deactivate function after calling SAPI activate to get per-directory settings (not used by the CGI/FastCGI SAPIs)</TD></TR>
+ * <TR><TH>@c chuid.chroot_cache_size</TH><TD>@c int</TD><TD>Maximum number of entries in the per-directory @c chuid.chroot_to cache (CGI/FastCGI/FPM)</TD></TR>
+ * <TR><TH>@c chuid.chroot_fd_cache_size</TH><TD>@c int</TD><TD>How many descriptors of the per-request @c chroot directories to keep open; 0 disables the cache</TD></TR>
+ * <TR><TH>@c chuid.chroot_fd_cache_ttl</TH><TD>@c int</TD><TD>How often (in seconds) to check that the path of a cached jail still leads to the same directory; 0 checks on every use</TD></TR>
+ * <TR><TH>@c chuid.defer_restore</TH><TD>@c bool</TD><TD>Keep the credentials of the request after it finishes and restore them only if the next request runs as a different user</TD></TR>
+ * <TR><TH>@c chuid.docroot_base</TH><TD>@c string</TD><TD>Common parent directory of the document roots; the document roots below it are looked up relative to its descriptor opened at startup</TD></TR>
+ * <TR><TH>@c chuid.docroot_statx</TH><TD>@c bool</TD><TD>Get the owner of the @c DOCUMENT_ROOT with @c statx() which asks only for UID/GID and does not force the file system to revalidate its cache</TD></TR>
+ * <TR><TH>@c chuid.docroot_cache_ttl</TH><TD>@c int</TD><TD>How long (in seconds) to cache the owner of the @c DOCUMENT_ROOT; 0 disables the cache</TD></TR>
+ * <TR><TH>@c chuid.docroot_cache_size</TH><TD>@c int</TD><TD>Maximum number of entries in the @c DOCUMENT_ROOT cache</TD></TR>
+ * <TR><TH>@c chuid.shm_cache_slots</TH><TD>@c int</TD><TD>Number of slots in the @c DOCUMENT_ROOT cache shared between all worker processes; 0 disables the shared cache</TD></TR>
+ * <TR><TH>@c chuid.prewarm_list</TH><TD>@c string</TD><TD>File with the document roots whose owners, per-request roots and jail descriptors are cached at startup, before the SAPI forks its workers</TD></TR>
+ * <TR><TH>@c chuid.supplementary_groups</TH><TD>@c bool</TD><TD>Set the supplementary groups of the user instead of clearing them</TD></TR>
+ * <TR><TH>@c chuid.groups_refresh_interval</TH><TD>@c int</TD><TD>How often (in seconds) the workers rebuild the supplementary groups index; 0 disables the rebuilding</TD></TR>
+ * <TR><TH>@c chuid.vhost_file</TH><TD>@c string</TD><TD>File with <code>host uid gid</code> lines; the host name of the request determines UID/GID</TD></TR>
+ * <TR><TH>@c chuid.vhost_variable</TH><TD>@c string</TD><TD>Server variable with the host name of the request</TD></TR>
+ * <TR><TH>@c chuid.map_file</TH><TD>@c string</TD><TD>Map file compiled by @c tools/chuid-mapc.php: path prefix → UID, GID and optional per-request @c chroot</TD></TR>
+ * <TR><TH>@c chuid.map_use_script_filename</TH><TD>@c bool</TD><TD>Look up @c SCRIPT_FILENAME instead of @c DOCUMENT_ROOT in @c chuid.map_file</TD></TR>
+ * <TR><TH>@c chuid.metrics_slots</TH><TD>@c int</TD><TD>Number of per-worker slots in the metrics segment shared between the FastCGI workers; 0 disables the metrics</TD></TR>
+ * <TR><TH>@c chuid.metrics_file</TH><TD>@c string</TD><TD>File to write the metrics to, in Prometheus text format</TD></TR>
+ * <TR><TH>@c chuid.metrics_interval</TH><TD>@c int</TD><TD>How often (in seconds) to write @c chuid.metrics_file</TD></TR>
+ * <TR><TH>@c chuid.warning_interval</TH><TD>@c int</TD><TD>Report the same @c DOCUMENT_ROOT error at most once per this many seconds; 0 reports every error</TD></TR>
+ * <TR><TH>@c chuid.realpath_partitions_size</TH><TD>@c int</TD><TD>Keep the realpath cache of every UID and per-request root in its own partition; the most memory (in bytes) the inactive partitions may take. 0 disables the partitioning</TD></TR>
+ * <TR><TH>@c chuid.mode</TH><TD>@c string</TD><TD>@c default: change the real, effective and saved UID/GID; @c fsuid: change only the filesystem UID/GID (Linux, needs @c libcap or @c libcap-ng, and the functions which run programs or act on other processes in @c disable_functions; every request still has the effective UID 0 for peer credentials and System V IPC)</TD></TR>
+ * <TR><TH>@c chuid.thread_credentials</TH><TD>@c bool</TD><TD>Change the credentials of the calling thread only, so that a threaded SAPI can serve requests of different users concurrently (ZTS builds on Linux)</TD></TR>
+ * <TR><TH>@c chuid.collect_stats</TH><TD>@c bool</TD><TD>Whether to collect per-phase latency histograms (see @c chuid_get_stats())</TD></TR>
  * </TABLE>
  */
 PHP_INI_BEGIN()
@@ -77,11 +115,51 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("chuid.global_chroot",                 "",      PHP_INI_SYSTEM,             OnUpdateString, global_chroot,       zend_chuid_globals, chuid_globals)
 	STD_PHP_INI_BOOLEAN("chuid.enable_per_request_chroot",   "0",     PHP_INI_SYSTEM,             OnUpdateBool,   per_req_chroot,      zend_chuid_globals, chuid_globals)
 	STD_PHP_INI_ENTRY_EX("chuid.chroot_to",                  "",      CHUID_INI_SYSTEM_OR_PERDIR, OnUpdateString, req_chroot,          zend_chuid_globals, chuid_globals, chuid_protected_displayer)
+	STD_PHP_INI_BOOLEAN("chuid.stay_in_jail",                "0",     PHP_INI_SYSTEM,             OnUpdateBool,   stay_in_jail,        zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.chroot_rewrite_vars",           "DOCUMENT_ROOT,SCRIPT_FILENAME", PHP_INI_SYSTEM, OnUpdateString, rewrite_vars, zend_chuid_globals, chuid_globals)
 	STD_PHP_INI_BOOLEAN("chuid.run_sapi_deactivate",         "1",     CHUID_INI_SYSTEM_OR_PERDIR, OnUpdateBool,   run_sapi_deactivate, zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.chroot_cache_size",             "1024",  PHP_INI_SYSTEM,             OnUpdateLong,   chroot_cache_size,   zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.chroot_fd_cache_size",          "0",     PHP_INI_SYSTEM,             OnUpdateLong,   jail_fd_cache_size,  zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.chroot_fd_cache_ttl",           "5",     PHP_INI_SYSTEM,             OnUpdateLong,   jail_fd_cache_ttl,   zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.defer_restore",               "0",     PHP_INI_SYSTEM,             OnUpdateBool,   defer_restore,       zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.docroot_base",                  "",      PHP_INI_SYSTEM,             OnUpdateString, docroot_base,        zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.docroot_statx",               "0",     PHP_INI_SYSTEM,             OnUpdateBool,   docroot_statx,       zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.docroot_cache_ttl",             "0",     PHP_INI_SYSTEM,             OnUpdateLong,   docroot_cache_ttl,   zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.docroot_cache_size",            "1024",  PHP_INI_SYSTEM,             OnUpdateLong,   docroot_cache_size,  zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.shm_cache_slots",               "0",     PHP_INI_SYSTEM,             OnUpdateLong,   shm_cache_slots,     zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.prewarm_list",                  "",      PHP_INI_SYSTEM,             OnUpdateString, prewarm_list,        zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.supplementary_groups",        "0",     PHP_INI_SYSTEM,             OnUpdateBool,   supplementary_groups, zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.groups_refresh_interval",       "0",     PHP_INI_SYSTEM,             OnUpdateLong,   groups_refresh_interval, zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.vhost_file",                    "",      PHP_INI_SYSTEM,             OnUpdateString, vhost_file,          zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.vhost_variable",                "SERVER_NAME", PHP_INI_SYSTEM,       OnUpdateString, vhost_variable,      zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.map_file",                      "",      PHP_INI_SYSTEM,             OnUpdateString, map_file,            zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.map_use_script_filename",     "0",     PHP_INI_SYSTEM,             OnUpdateBool,   map_use_script_filename, zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.metrics_slots",                 "0",     PHP_INI_SYSTEM,             OnUpdateLong,   metrics_slots,       zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.metrics_file",                  "",      PHP_INI_SYSTEM,             OnUpdateString, metrics_file,        zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.metrics_interval",              "10",    PHP_INI_SYSTEM,             OnUpdateLong,   metrics_interval,    zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.warning_interval",              "0",     PHP_INI_SYSTEM,             OnUpdateLong,   warning_interval,    zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.realpath_partitions_size",      "0",     PHP_INI_SYSTEM,             OnUpdateLong,   realpath_partitions_size, zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_ENTRY("chuid.mode",                          "default", PHP_INI_SYSTEM,           OnUpdateString, mode_name,           zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.thread_credentials",          "0",     PHP_INI_SYSTEM,             OnUpdateBool,   thread_credentials,  zend_chuid_globals, chuid_globals)
+	STD_PHP_INI_BOOLEAN("chuid.collect_stats",               "0",     PHP_INI_SYSTEM,             OnUpdateBool,   collect_stats,       zend_chuid_globals, chuid_globals)
 PHP_INI_END()
 
 #undef CHUID_INI_SYSTEM_OR_PERDIR
 
+/**
+ * @brief Arguments of @c chuid_get_stats()
+ */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_chuid_get_stats, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+/**
+ * @brief Functions exported by the module
+ */
+static const zend_function_entry chuid_functions[] = {
+	PHP_FE(chuid_get_stats, arginfo_chuid_get_stats)
+	PHP_FE_END
+};
+
 /**
  * @brief Module Initialization Routine
  * @param type
@@ -102,8 +180,16 @@ static PHP_MINIT_FUNCTION(chuid)
 
 	REGISTER_INI_ENTRIES();
 
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+	use_thread_credentials = CHUID_G(thread_credentials);
+#endif
+
 #ifdef ZTS
+#	ifdef PHPCHUID_THREAD_CREDENTIALS
+	if (!sapi_is_supported && !use_thread_credentials) {
+#	else
 	if (!sapi_is_supported) {
+#	endif
 		PHPCHUID_ERROR(E_WARNING, "Deactivating chuid because PHP SAPI is not supported: %s\n", sapi_module.name);
 		return SUCCESS;
 	}
@@ -125,6 +211,48 @@ static PHP_MINIT_FUNCTION(chuid)
 
 	disable_posix_setuids();
 
+	/* NSS is consulted only here: once per process (not per thread), before fork() and chroot() */
+	if (65534 == CHUID_G(default_uid)) {
+		struct passwd* pwd;
+
+		errno = 0;
+		pwd   = getpwnam("nobody");
+		if (NULL != pwd) {
+			uid_nobody  = pwd->pw_uid;
+			gid_nogroup = pwd->pw_gid;
+		}
+		else {
+			PHPCHUID_ERROR(E_CORE_WARNING, "getpwnam(nobody) failed: %s", strerror(errno));
+		}
+	}
+
+	if (CHUID_G(supplementary_groups) && !no_gid) {
+		groups_index_build();
+	}
+
+	if (CHUID_G(docroot_cache_ttl) > 0 && CHUID_G(shm_cache_slots) > 0) {
+		/* Must be created before the SAPI forks its children */
+		if (FAILURE == shm_cache_init((size_t)CHUID_G(shm_cache_slots))) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "Failed to create the shared DOCUMENT_ROOT cache: %s", strerror(errno));
+		}
+	}
+
+	if (CHUID_G(vhost_file) && *CHUID_G(vhost_file)) {
+		vhosts_load(CHUID_G(vhost_file));
+	}
+
+	if (CHUID_G(map_file) && *CHUID_G(map_file)) {
+		/* Mapped before fork() and chroot(), so that all workers share the pages */
+		map_file_open(CHUID_G(map_file));
+	}
+
+	if (CHUID_G(metrics_slots) > 0 && !sapi_is_cli && !sapi_is_cgi) {
+		/* Must be created before the SAPI forks its children */
+		if (FAILURE == metrics_init((size_t)CHUID_G(metrics_slots))) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "Failed to create the shared metrics segment: %s", strerror(errno));
+		}
+	}
+
 	if (!sapi_is_cli || !CHUID_G(cli_disable)) {
 		int can_setgid = -1;
 		int can_setuid = -1;
@@ -150,9 +278,27 @@ static PHP_MINIT_FUNCTION(chuid)
 		CHUID_G(per_req_chroot) = 0;
 	}
 
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+	if (use_thread_credentials && CHUID_G(per_req_chroot)) {
+		/* The root directory belongs to the process, not to the thread */
+		PHPCHUID_ERROR(E_CORE_WARNING, "%s", "chuid.enable_per_request_chroot does not work with chuid.thread_credentials - disabling per-request chroot");
+		CHUID_G(per_req_chroot) = 0;
+	}
+#endif
+
 	per_req_chroot = CHUID_G(per_req_chroot);
 	if (per_req_chroot) {
-		int root_fd = open(
+		int root_fd;
+
+		compile_rewrite_vars(CHUID_G(rewrite_vars));
+		hook_auto_globals();
+
+		if (sapi_has_user_ini && !sapi_is_fpm && !CHUID_G(run_sapi_deactivate)) {
+			/* chuid.chroot_to is computed without SAPI Activate */
+			PHPCHUID_ERROR(E_CORE_WARNING, "chuid.run_sapi_deactivate has no effect with the %s SAPI", sapi_module.name);
+		}
+
+		root_fd = open(
 			"/",
 			O_RDONLY
 #		ifdef O_CLOEXEC
@@ -183,18 +329,80 @@ static PHP_MINIT_FUNCTION(chuid)
 		return FAILURE;
 	}
 
+	if (CHUID_G(docroot_base) && *CHUID_G(docroot_base)) {
+		/* After the global chroot: the document roots are paths inside it */
+		docroot_base_open(CHUID_G(docroot_base));
+	}
+
+	if (CHUID_G(prewarm_list) && *CHUID_G(prewarm_list) && (!sapi_is_cli || !CHUID_G(cli_disable))) {
+		/* Still privileged, inside the global chroot, and before fork(): the workers inherit the filled caches */
+		prewarm_load(CHUID_G(prewarm_list));
+	}
+
 	PHPCHUID_DEBUG("%d %d\n", sapi_is_cli, CHUID_G(cli_disable));
 	if (!sapi_is_cli || !CHUID_G(cli_disable)) {
-		int num_caps = 0;
+		int num_caps      = 0;
+		zend_bool fs_mode = 0;
+		const char* name  = CHUID_G(mode_name);
 		cap_value_t caps[5];
 
-		if (sapi_is_cli || sapi_is_cgi) {
+		if (name && *name && 0 != strcmp(name, "default")) {
+#ifdef PHPCHUID_HAVE_FSUID
+			if (0 == strcmp(name, "fsuid")) {
+				fs_mode = 1;
+			}
+			else
+#endif
+			{
+				PHPCHUID_ERROR(E_CORE_WARNING, "chuid.mode=%s is not supported - using the default mode", name);
+			}
+		}
+
+#ifdef PHPCHUID_HAVE_FSUID
+		if (fs_mode) {
+			/* The programs started by the script would run as root */
+			const char* fn = find_fs_unsafe_function();
+
+			if (fn) {
+				PHPCHUID_ERROR(E_CORE_WARNING, "chuid.mode=fsuid requires %s() to be in disable_functions - using the default mode", fn);
+				fs_mode = 0;
+			}
+		}
+#endif
+
+		if (fs_mode) {
+			CHUID_G(mode) = (0 == no_gid) ? cxm_setfsxid : cxm_setfsuid;
+
+			/* Otherwise the requests would have the supplementary groups of the process; set_guids() does not touch them in this mode */
+			if (0 == no_gid && !CHUID_G(supplementary_groups) && 0 != setgroups(0, NULL)) {
+				PHPCHUID_ERROR(E_CORE_WARNING, "Failed to clear the list of supplementary groups: %s", strerror(errno));
+			}
+		}
+		else if (sapi_is_cli || sapi_is_cgi) {
+			/* The script must not be able to regain root; with chuid.thread_credentials, the threads it starts inherit its credentials */
 			CHUID_G(mode) = (0 == no_gid) ? cxm_setxid : cxm_setuid;
 		}
 		else {
 			CHUID_G(mode) = (0 == no_gid) ? cxm_setresxid : cxm_setresuid;
 		}
 
+		/* Deferred restore relies upon the saved UID staying 0; escaping the per-request chroot needs the privileges back right away */
+		if (CHUID_G(defer_restore) && (sapi_is_cli || sapi_is_cgi || per_req_chroot)) {
+			CHUID_G(defer_restore) = 0;
+		}
+
+		/* With cgi.fix_pathinfo, php-cgi and FPM stat() the script before the request starts, i.e., as the previous user */
+		if (CHUID_G(defer_restore) && INI_INT("cgi.fix_pathinfo")) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "%s", "chuid.defer_restore requires cgi.fix_pathinfo=0 and has been disabled");
+			CHUID_G(defer_restore) = 0;
+		}
+
+		/* With cgi.fix_pathinfo, php-cgi and FPM resolve the script before the request starts, i.e., inside the jail of the previous request */
+		if (CHUID_G(stay_in_jail) && per_req_chroot && INI_INT("cgi.fix_pathinfo")) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "%s", "chuid.stay_in_jail requires cgi.fix_pathinfo=0 and has been disabled");
+			CHUID_G(stay_in_jail) = 0;
+		}
+
 #if defined(WITH_CAP_LIBRARY) || defined(WITH_CAPNG_LIBRARY)
 		if (need_chroot) {
 			caps[num_caps] = CAP_SYS_CHROOT;
@@ -221,6 +429,10 @@ static PHP_MINIT_FUNCTION(chuid)
 		CHUID_G(active) = 1;
 	}
 
+#ifdef ZTS
+	save_thread_template();
+#endif
+
 	return SUCCESS;
 }
 
@@ -237,96 +449,39 @@ static PHP_MSHUTDOWN_FUNCTION(chuid)
 	PHPCHUID_DEBUG("%s\n", "PHP_MSHUTDOWN(chuid)");
 
 	if (0 != CHUID_G(enabled) && 0 != CHUID_G(disable_setuid)) {
-		zend_hash_clean(&blacklisted_functions);
-		zend_execute_internal = (old_execute_internal == execute_internal) ? NULL : old_execute_internal;
+		restore_posix_setuids();
 	}
 
-	if (CHUID_G(root_fd) > -1) {
-		close(CHUID_G(root_fd));
-	}
+	unhook_auto_globals();
+	free_rewrite_vars();
 
-	UNREGISTER_INI_ENTRIES();
+	shm_cache_destroy();
 
-	return SUCCESS;
-}
-
-/**
- * If @c chroot() was performed, adjusts <code>$_SERVER['DOCUMENT_ROOT']</code>, <code>$_SERVER['SCRIPT_FILENAME']</code>,
- * <code>$_ENV['DOCUMENT_ROOT']</code> and <code>$_ENV['SCRIPT_FILENAME']</code> by stripping <code>CHUID_G(req_chroot)</code>
- * from them.
- *
- * @brief Request Initialization handler
- * @param type Module type (persistent or temporary)
- * @param module_number Module number
- * @return Whether initialization was successful
- * @retval SUCCESS Yes
- * @retval FAILURE No
- * @todo Throw a warning if the document root lays outside the new root.
- */
-static PHP_RINIT_FUNCTION(chuid)
-{
-	PHPCHUID_DEBUG("%s\n", "PHP_RINIT(chuid)");
-
-	if (CHUID_G(chrooted)) {
-		zval* http_globals;
-
-		http_globals = PG(http_globals);
-		char* root   = CHUID_G(req_chroot);
-		size_t len   = strlen(root);
-
-		if (PG(auto_globals_jit)) {
-			chuid_is_auto_global("_SERVER", sizeof("_SERVER")-1);
-			chuid_is_auto_global("_ENV", sizeof("_ENV")-1);
-		}
+	if (CHUID_G(switched)) {
+		/* chuid.defer_restore has left the process with the credentials of the last request */
+		restore_guids(E_CORE_WARNING);
+	}
 
-		if (Z_TYPE(http_globals[TRACK_VARS_SERVER]) == IS_ARRAY) {
-			zval* var;
-			var = zend_hash_str_find(Z_ARRVAL(http_globals[TRACK_VARS_SERVER]), ZEND_STRL("DOCUMENT_ROOT"));
-			if (var && Z_TYPE_P(var) == IS_STRING) {
-				if (!strncmp(Z_STRVAL_P(var), root, len)) {
-					SEPARATE_ZVAL(var);
-					memmove(Z_STRVAL_P(var), Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len+1);
-					Z_STRLEN_P(var) -= len;
-					zend_string_forget_hash_val(Z_STR_P(var));
-				}
-			}
+	if (CHUID_G(in_jail)) {
+		/* chuid.stay_in_jail has left the process in the root of the last request */
+		leave_jail(E_CORE_WARNING);
+	}
 
-			var = zend_hash_str_find(Z_ARRVAL(http_globals[TRACK_VARS_SERVER]), ZEND_STRL("SCRIPT_FILENAME"));
-			if (var && Z_TYPE_P(var) == IS_STRING) {
-				if (!strncmp(Z_STRVAL_P(var), root, len)) {
-					SEPARATE_ZVAL(var);
-					memmove(Z_STRVAL_P(var), Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len+1);
-					Z_STRLEN_P(var) -= len;
-					zend_string_forget_hash_val(Z_STR_P(var));
-				}
-			}
-		}
+	metrics_export(1);
+	ratelimit_flush(1);
 
-		/* This is probably not needed — updating $_SERVER seems to update $_ENV as well. But I want to be safe. */
-		if (Z_TYPE(http_globals[TRACK_VARS_SERVER]) == IS_ARRAY) {
-			zval* var;
-			var = zend_hash_str_find(Z_ARRVAL(http_globals[TRACK_VARS_ENV]), ZEND_STRL("DOCUMENT_ROOT"));
-			if (var && Z_TYPE_P(var) == IS_STRING) {
-				if (!strncmp(Z_STRVAL_P(var), root, len)) {
-					SEPARATE_ZVAL(var);
-					memmove(Z_STRVAL_P(var), Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len+1);
-					Z_STRLEN_P(var) -= len;
-					zend_string_forget_hash_val(Z_STR_P(var));
-				}
-			}
+	metrics_destroy();
+	map_file_close();
+	vhosts_free();
+	groups_index_free();
+	docroot_base_close();
 
-			var = zend_hash_str_find(Z_ARRVAL(http_globals[TRACK_VARS_ENV]), ZEND_STRL("SCRIPT_FILENAME"));
-			if (var && Z_TYPE_P(var) == IS_STRING) {
-				if (!strncmp(Z_STRVAL_P(var), root, len)) {
-					SEPARATE_ZVAL(var);
-					memmove(Z_STRVAL_P(var), Z_STRVAL_P(var)+len, Z_STRLEN_P(var)-len+1);
-					Z_STRLEN_P(var) -= len;
-					zend_string_forget_hash_val(Z_STR_P(var));
-				}
-			}
-		}
+	if (CHUID_G(root_fd) > -1) {
+		close(CHUID_G(root_fd));
 	}
 
+	UNREGISTER_INI_ENTRIES();
+
 	return SUCCESS;
 }
 
@@ -340,45 +495,86 @@ static PHP_GINIT_FUNCTION(chuid)
 {
 	PHPCHUID_DEBUG("%s\n", "PHP_GINIT(chuid)");
 
-	struct passwd* pwd;
 	uid_t suid;
 	gid_t sgid;
 
-	assert(-1 == sapi_is_cli);
-	assert(-1 == sapi_is_cgi);
+	/* Under ZTS, the constructor runs for every thread */
+	if (-1 == sapi_is_cli) {
+		sapi_is_cli = (0 == strcmp(sapi_module.name, "cli")) || (0 == strcmp(sapi_module.name, "phpdbg"));
+		sapi_is_cgi = (0 == strcmp(sapi_module.name, "cgi"));
+		sapi_is_fpm = (0 == strcmp(sapi_module.name, "fpm-fcgi"));
 
-	sapi_is_cli = (0 == strcmp(sapi_module.name, "cli")) || (0 == strcmp(sapi_module.name, "phpdbg"));
-	sapi_is_cgi = (0 == strcmp(sapi_module.name, "cgi"));
+		sapi_has_user_ini =
+			   (0 == strcmp(sapi_module.name, "cgi"))
+			|| (0 == strcmp(sapi_module.name, "cgi-fcgi"))
+			|| (0 == strcmp(sapi_module.name, "fpm-fcgi"))
+		;
 
 #ifdef ZTS
-	sapi_is_supported =
-		   sapi_is_cli
-		|| sapi_is_cgi
-		|| (0 == strncmp(sapi_module.name, "cgi-", 4))
-		|| (0 == strncmp(sapi_module.name, "cli-", 4))
-	;
+		sapi_is_supported =
+			   sapi_is_cli
+			|| sapi_is_cgi
+			|| (0 == strncmp(sapi_module.name, "cgi-", 4))
+			|| (0 == strncmp(sapi_module.name, "cli-", 4))
+		;
 #endif
+	}
 
 	getresuid(&chuid_globals->ruid, &chuid_globals->euid, &suid);
 	getresgid(&chuid_globals->rgid, &chuid_globals->egid, &sgid);
 	chuid_globals->active = 0;
 
-	errno = 0;
-	pwd   = getpwnam("nobody");
-	if (NULL != pwd) {
-		uid_nobody  = pwd->pw_uid;
-		gid_nogroup = pwd->pw_gid;
-	}
-	else {
-		PHPCHUID_ERROR(E_WARNING, "getpwnam(nobody) failed: %s", strerror(errno));
-	}
-
 
 	chuid_globals->global_chroot  = NULL;
 	chuid_globals->per_req_chroot = 0;
 	chuid_globals->req_chroot     = NULL;
+	chuid_globals->jail           = NULL;
 	chuid_globals->root_fd        = -1;
 	chuid_globals->chrooted       = 0;
+	chuid_globals->switched       = 0;
+	chuid_globals->thread_ready   = 0;
+	chuid_globals->in_jail        = 0;
+	chuid_globals->map_chroot     = NULL;
+
+	chuid_globals->docroot_cache_hits      = 0;
+	chuid_globals->docroot_cache_shm_hits  = 0;
+	chuid_globals->docroot_cache_misses    = 0;
+	chuid_globals->docroot_cache_evictions = 0;
+	chuid_globals->warnings_suppressed     = 0;
+	chuid_globals->warnings_next_flush     = 0;
+	memset(chuid_globals->stats, 0, sizeof(chuid_globals->stats));
+	ratelimit_init(&chuid_globals->warnings);
+	rpcache_init(&chuid_globals->rpcache);
+	chuid_globals->rpcache_key    = NULL;
+	chuid_globals->rpcache_parked = 0;
+	docroot_cache_init(&chuid_globals->docroot_cache);
+	chroot_cache_init(&chuid_globals->chroot_cache);
+	jail_fd_cache_init(&chuid_globals->jail_fds);
+}
+
+/**
+ * @brief Globals Destructor
+ * @param chuid_globals Pointer to the globals container
+ */
+static PHP_GSHUTDOWN_FUNCTION(chuid)
+{
+	PHPCHUID_DEBUG("%s\n", "PHP_GSHUTDOWN(chuid)");
+
+	docroot_cache_destroy(&chuid_globals->docroot_cache);
+	chroot_cache_destroy(&chuid_globals->chroot_cache);
+	jail_fd_cache_destroy(&chuid_globals->jail_fds);
+	ratelimit_destroy(&chuid_globals->warnings);
+	rpcache_destroy(&chuid_globals->rpcache);
+
+	if (chuid_globals->rpcache_key) {
+		zend_string_release(chuid_globals->rpcache_key);
+		chuid_globals->rpcache_key = NULL;
+	}
+
+	if (chuid_globals->jail) {
+		zend_string_release(chuid_globals->jail);
+		chuid_globals->jail = NULL;
+	}
 }
 
 /**
@@ -392,8 +588,42 @@ static PHP_MINFO_FUNCTION(chuid)
 	php_info_print_table_start();
 	php_info_print_table_row(2, "Change User ID Module", "enabled");
 	php_info_print_table_row(2, "version", PHP_CHUID_EXTVER);
+#ifdef HAVE_CHUID_PROBES
+	php_info_print_table_row(2, "USDT probes", "enabled");
+#else
+	php_info_print_table_row(2, "USDT probes", "disabled");
+#endif
+#if defined(WITH_CAP_LIBRARY)
+	php_info_print_table_row(2, "capabilities library", "libcap");
+#elif defined(WITH_CAPNG_LIBRARY)
+	php_info_print_table_row(2, "capabilities library", "libcap-ng");
+#else
+	php_info_print_table_row(2, "capabilities library", "none");
+#endif
 	php_info_print_table_end();
 
+	if (CHUID_G(docroot_cache_ttl) > 0) {
+		char buf[32];
+
+		php_info_print_table_start();
+		php_info_print_table_header(2, "DOCUMENT_ROOT cache", "value");
+		snprintf(buf, sizeof(buf), "%u", zend_hash_num_elements(&CHUID_G(docroot_cache)));
+		php_info_print_table_row(2, "entries", buf);
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, CHUID_G(docroot_cache_hits));
+		php_info_print_table_row(2, "hits", buf);
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, CHUID_G(docroot_cache_shm_hits));
+		php_info_print_table_row(2, "shared cache hits", buf);
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, CHUID_G(docroot_cache_misses));
+		php_info_print_table_row(2, "misses", buf);
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, CHUID_G(docroot_cache_evictions));
+		php_info_print_table_row(2, "evictions", buf);
+		php_info_print_table_end();
+	}
+
+	if (CHUID_G(collect_stats)) {
+		stats_print_info();
+	}
+
 	DISPLAY_INI_ENTRIES();
 }
 
@@ -420,16 +650,16 @@ static ZEND_MODULE_POST_ZEND_DEACTIVATE_D(chuid)
 zend_module_entry chuid_module_entry = {
 	STANDARD_MODULE_HEADER,
 	PHP_CHUID_EXTNAME,
-	NULL,
+	chuid_functions,
 	PHP_MINIT(chuid),
 	PHP_MSHUTDOWN(chuid),
-	PHP_RINIT(chuid),
+	NULL,
 	NULL,
 	PHP_MINFO(chuid),
 	PHP_CHUID_EXTVER,
 	PHP_MODULE_GLOBALS(chuid),
 	PHP_GINIT(chuid),
-	NULL,
+	PHP_GSHUTDOWN(chuid),
 	ZEND_MODULE_POST_ZEND_DEACTIVATE_N(chuid),
 	STANDARD_MODULE_PROPERTIES_EX
 };
@@ -20,11 +20,26 @@ PHP_ARG_WITH(
 	[no]
 )
 
+PHP_ARG_ENABLE(
+	[chuid-probes],
+	[whether to enable USDT probes in the "chuid" extension],
+	[  --enable-chuid-probes     Enable USDT (SystemTap SDT) probes],
+	[no],
+	[no]
+)
 
 if test $PHP_CHUID != "no"; then
-	AC_CHECK_FUNCS([getresuid setresuid])
+	AC_CHECK_FUNCS([getresuid setresuid statx mkostemp])
 	AC_CHECK_HEADERS([sys/types.h sys/stat.h fcntl.h unistd.h])
 
+	if test "$PHP_CHUID_PROBES" != "no"; then
+		AC_CHECK_HEADER(
+			[sys/sdt.h],
+			[AC_DEFINE([HAVE_CHUID_PROBES], [1], [Whether USDT probes are enabled])],
+			[AC_MSG_ERROR([sys/sdt.h is required for --enable-chuid-probes (install systemtap-sdt-dev or systemtap-sdt-devel)])]
+		)
+	fi
+
 	if test "$PHP_CAP" != "no"; then
 		for i in $PHP_CAP /usr/local /usr; do
 			test -f $i/include/sys/capability.h && CAP_DIR=$i && break
@@ -66,7 +81,7 @@ if test $PHP_CHUID != "no"; then
 		fi
 	fi
 
-	PHP_NEW_EXTENSION(chuid, [chuid.c caps.c helpers.c extension.c], $ext_shared, [cgi], [-Wall -std=gnu99 -D_GNU_SOURCE])
+	PHP_NEW_EXTENSION(chuid, [chuid.c caps.c cache.c chroot.c shmcache.c metrics.c mapfile.c vhosts.c groups.c ratelimit.c rpcache.c prewarm.c stats.c helpers.c extension.c], $ext_shared, [cgi], [-Wall -std=gnu99 -D_GNU_SOURCE])
 	PHP_SUBST(CHUID_SHARED_LIBADD)
 	PHP_ADD_MAKEFILE_FRAGMENT
 fi
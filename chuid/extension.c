@@ -7,7 +7,12 @@
 
 #include <assert.h>
 #include "extension.h"
+#include "chroot.h"
 #include "helpers.h"
+#include "metrics.h"
+#include "probes.h"
+#include "rpcache.h"
+#include "stats.h"
 
 int zext_loaded = 0;  /**< Whether Zend Extension part has been loaded */
 
@@ -43,58 +48,122 @@ static void chuid_zend_activate(void)
 {
 	PHPCHUID_DEBUG("%s\n", "zend_activate");
 
+#ifdef ZTS
+	if (UNEXPECTED(!CHUID_G(thread_ready))) {
+		init_thread_state();
+	}
+#endif
+
 	if (1 == CHUID_G(active)) {
 		uid_t uid;
 		gid_t gid;
+		uint64_t started = stats_start();
+		uint64_t start   = started;
+
+		metrics_start_request();
+		CHUID_PROBE0(activate__start);
 
 		/* We must get UID and GID before chrooting */
 		get_docroot_guids(&uid, &gid);
+		stats_stop(cph_docroot, start);
 
 		if (CHUID_G(per_req_chroot) && !sapi_is_cli) {
+			const char* root;
+			size_t len;
+
 			CHUID_G(chrooted) = 0;
-			/*
-			 * We have to call sapi_module.activate() explicitly because SAPI Activate is called before REQUEST_INIT and after
-			 * ZEND_ACTIVATE. SAPI Activate sets per-directory INI settings, and chroot()'ing in the RINIT phase is too late.
-			 */
-			if (sapi_module.activate) {
-				sapi_module.activate();
+			start = stats_start();
+			if (CHUID_G(map_chroot)) {
+				/* chuid.map_file takes precedence over chuid.chroot_to */
+				root = CHUID_G(map_chroot);
+				len  = CHUID_G(map_chroot_len);
 			}
+			else if (sapi_has_user_ini && !req_has_ini_values()) {
+				/* Per-directory settings come from php.ini and user INI files, we can get chuid.chroot_to without SAPI Activate */
+				zend_string* r = resolve_req_chroot();
+
+				root = r ? ZSTR_VAL(r) : NULL;
+				len  = r ? ZSTR_LEN(r) : 0;
+			}
+			else {
+				/*
+				 * We have to call sapi_module.activate() explicitly because SAPI Activate is called before REQUEST_INIT and after
+				 * ZEND_ACTIVATE. SAPI Activate sets per-directory INI settings, and chroot()'ing in the RINIT phase is too late.
+				 */
+				if (CHUID_G(in_jail)) {
+					/* There is no telling which files the SAPI reads */
+					leave_jail(E_CORE_ERROR);
+				}
+
+				if (sapi_module.activate) {
+					sapi_module.activate();
+				}
+
+				if (CHUID_G(run_sapi_deactivate) && sapi_module.deactivate) {
+					sapi_module.deactivate();
+				}
 
-			if (CHUID_G(run_sapi_deactivate) && sapi_module.deactivate) {
-				sapi_module.deactivate();
+				root = CHUID_G(req_chroot);
+				len  = root ? strlen(root) : 0;
 			}
 
-			char* root = CHUID_G(req_chroot);
+			stats_stop(cph_chroot_to, start);
+
 			PHPCHUID_DEBUG("Per-request root is \"%s\"\n", root);
 
 			if (root && *root && '/' == *root) {
-				int res  = do_chroot(root);
-				char* pt = SG(request_info).path_translated;
-				if (FAILURE == res) {
-					return;
+				int res;
+				char* pt    = SG(request_info).path_translated;
+				size_t jlen = len;
+
+				if (root[jlen-1] == '/' || root[jlen-1] == '\\') {
+					--jlen;
 				}
 
+				if (CHUID_G(in_jail) && ZSTR_LEN(CHUID_G(jail)) == jlen && !memcmp(ZSTR_VAL(CHUID_G(jail)), root, jlen) && jail_is_current(root, len)) {
+					/* chuid.stay_in_jail: the previous request has left the process here; the SAPI changes the directory to that of the script itself */
+					CHUID_G(in_jail) = 0;
+				}
+				else {
+					if (CHUID_G(in_jail)) {
+						leave_jail(E_CORE_ERROR);
+					}
+
+					start = stats_start();
+					res   = enter_jail(root, len);
+					stats_stop(cph_chroot, start);
+					if (FAILURE == res) {
+						stats_stop(cph_activate, started);
+						return;
+					}
+				}
+
+				metrics_inc(cmt_chroots);
+				set_jail(root, jlen);
 				CHUID_G(chrooted) = 1;
 				if (pt) {
-					size_t len = strlen(root);
-					if (root[len-1] == '/' || root[len-1] == '\\') {
-						--len;
-						CHUID_G(req_chroot)[len] = 0;
-					}
+					size_t pt_len = strlen(pt);
 
-					if (!strncmp(pt, root, len)) {
-						memmove(pt, pt+len, strlen(pt)-len+1);
+					len = jail_prefix_len(pt, pt_len);
+					if (len) {
+						memmove(pt, pt+len, pt_len-len+1);
 						PHPCHUID_DEBUG("New PATH_TRANSLATED is \"%s\"\n", pt);
 					}
 				}
 			}
+			else if (CHUID_G(in_jail)) {
+				leave_jail(E_CORE_ERROR);
+			}
 		}
 
 		if (sapi_is_cli || sapi_is_cgi) {
 			CHUID_G(active) = 0;
 		}
 
+		rpcache_switch(uid, CHUID_G(chrooted) ? CHUID_G(jail) : NULL);
 		set_guids(uid, gid);
+		stats_stop(cph_activate, started);
+		CHUID_PROBE3(activate__done, uid, gid, (int)CHUID_G(chrooted));
 
 		PHPCHUID_DEBUG("UID: %d, GID: %d\n", getuid(), getgid());
 	}
@@ -0,0 +1,195 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief UID → supplementary groups index — implementation
+ *
+ * The index is built in MINIT, before the SAPI forks its children, by enumerating the user and the group databases once.
+ * The requests only look the UID up in the index, so that NSS (which may mean LDAP or sssd round trips) is never
+ * called while a request is being served.
+ */
+
+#include <time.h>
+#include <grp.h>
+#include <pwd.h>
+#include "groups.h"
+
+/**
+ * @brief Groups of a user
+ */
+typedef struct _groups_entry {
+	int count;      /**< Number of groups */
+	int size;       /**< Capacity of @c gids */
+	gid_t gids[1];  /**< Groups */
+} groups_entry;
+
+/**
+ * @brief UID → @c groups_entry
+ */
+static HashTable* groups_index = NULL;
+
+/**
+ * @brief When the index has to be rebuilt
+ */
+static time_t groups_next_refresh = 0;
+
+/**
+ * @brief Maximum number of supplementary groups
+ */
+static int groups_max = 0;
+
+/**
+ * @brief Entry destructor
+ * @param zv Entry to destroy
+ */
+static void groups_dtor(zval* zv)
+{
+	pefree(Z_PTR_P(zv), 1);
+}
+
+/**
+ * @brief Destroys the index
+ * @param ht Index
+ */
+static void destroy_index(HashTable* ht)
+{
+	zend_hash_destroy(ht);
+	pefree(ht, 1);
+}
+
+/**
+ * @brief Adds the group to the list of the groups of the user
+ * @param ht Index
+ * @param uid UID
+ * @param gid GID
+ */
+static void add_group(HashTable* ht, uid_t uid, gid_t gid)
+{
+	int i;
+	groups_entry* e = zend_hash_index_find_ptr(ht, (zend_ulong)uid);
+
+	if (!e) {
+		e        = pemalloc(sizeof(groups_entry) + 7 * sizeof(gid_t), 1);
+		e->count = 0;
+		e->size  = 8;
+		zend_hash_index_update_ptr(ht, (zend_ulong)uid, e);
+	}
+
+	for (i=0; i<e->count; ++i) {
+		if (e->gids[i] == gid) {
+			return;
+		}
+	}
+
+	if (e->count >= groups_max) {
+		return;
+	}
+
+	if (e->count == e->size) {
+		e->size *= 2;
+		e        = perealloc(e, sizeof(groups_entry) + (size_t)(e->size - 1) * sizeof(gid_t), 1);
+		zend_hash_index_update_ptr(ht, (zend_ulong)uid, e);
+	}
+
+	e->gids[e->count] = gid;
+	++e->count;
+}
+
+/**
+ * The list of a user consists of the primary group of the user followed by the groups listing him as a member (like @c initgroups() does).
+ */
+int groups_index_build(void)
+{
+	HashTable users;
+	HashTable* ht;
+	struct passwd* pw;
+	struct group* gr;
+	long int max = sysconf(_SC_NGROUPS_MAX);
+
+	groups_max = (max > 0 && max < 65536) ? (int)max : 65536;
+
+	ht = pemalloc(sizeof(HashTable), 1);
+	zend_hash_init(ht, 64, NULL, groups_dtor, 1);
+	zend_hash_init(&users, 64, NULL, NULL, 1);
+
+	errno = 0;
+	setpwent();
+	while ((pw = getpwent())) {
+		zval v;
+
+		ZVAL_LONG(&v, (zend_long)pw->pw_uid);
+		zend_hash_str_update(&users, pw->pw_name, strlen(pw->pw_name), &v);
+		add_group(ht, pw->pw_uid, pw->pw_gid);
+	}
+
+	endpwent();
+
+	setgrent();
+	while ((gr = getgrent())) {
+		char** member;
+
+		for (member = gr->gr_mem; member && *member; ++member) {
+			zval* uid = zend_hash_str_find(&users, *member, strlen(*member));
+			if (uid) {
+				add_group(ht, (uid_t)Z_LVAL_P(uid), gr->gr_gid);
+			}
+		}
+	}
+
+	endgrent();
+	zend_hash_destroy(&users);
+
+	if (0 == zend_hash_num_elements(ht)) {
+		PHPCHUID_ERROR(E_WARNING, "%s", "Failed to enumerate the user database: the supplementary groups will not be set");
+		destroy_index(ht);
+		return FAILURE;
+	}
+
+	if (groups_index) {
+		destroy_index(groups_index);
+	}
+
+	groups_index = ht;
+	if (CHUID_G(groups_refresh_interval) > 0) {
+		groups_next_refresh = time(NULL) + CHUID_G(groups_refresh_interval);
+	}
+
+	return SUCCESS;
+}
+
+void groups_index_free(void)
+{
+	if (groups_index) {
+		destroy_index(groups_index);
+		groups_index = NULL;
+	}
+}
+
+int groups_index_refresh_due(void)
+{
+	return groups_index && CHUID_G(groups_refresh_interval) > 0 && time(NULL) >= groups_next_refresh;
+}
+
+void groups_index_maybe_refresh(void)
+{
+	time_t now;
+
+	if (groups_index && CHUID_G(groups_refresh_interval) > 0 && (now = time(NULL)) >= groups_next_refresh) {
+		/* If the rebuild fails, the old index is kept until the next attempt */
+		groups_next_refresh = now + CHUID_G(groups_refresh_interval);
+		groups_index_build();
+	}
+}
+
+int groups_find(uid_t uid, const gid_t** groups)
+{
+	groups_entry* e = groups_index ? zend_hash_index_find_ptr(groups_index, (zend_ulong)uid) : NULL;
+
+	if (!e) {
+		*groups = NULL;
+		return 0;
+	}
+
+	*groups = e->gids;
+	return e->count;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief UID → supplementary groups index — definitions
+ */
+
+#ifndef PHPCHUID_GROUPS_H_
+#define PHPCHUID_GROUPS_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Builds (or rebuilds) the index from the user and group databases
+ * @return Whether the index has been built
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the previous index, if any, is kept)
+ * @note Enumerates the databases with @c getpwent() / @c getgrent(): this is the only place where NSS is called
+ */
+PHPCHUID_VISIBILITY_HIDDEN int groups_index_build(void);
+
+/**
+ * @brief Frees the index
+ */
+PHPCHUID_VISIBILITY_HIDDEN void groups_index_free(void);
+
+/**
+ * @brief Rebuilds the index if @c chuid.groups_refresh_interval seconds have passed since it was built
+ * @note Must be called between requests, with the original credentials and root directory
+ */
+PHPCHUID_VISIBILITY_HIDDEN void groups_index_maybe_refresh(void);
+
+/**
+ * @brief Checks whether @c groups_index_maybe_refresh() would rebuild the index now
+ * @return Whether @c chuid.groups_refresh_interval seconds have passed since the index was built
+ */
+PHPCHUID_VISIBILITY_HIDDEN int groups_index_refresh_due(void);
+
+/**
+ * @brief Finds the supplementary groups of the user
+ * @param uid UID
+ * @param groups [out] Groups (owned by the index); @c NULL if the user is not in the index
+ * @return Number of groups
+ */
+PHPCHUID_VISIBILITY_HIDDEN int groups_find(uid_t uid, const gid_t** groups);
+
+#endif /* PHPCHUID_GROUPS_H_ */
@@ -6,29 +6,121 @@
  */
 
 #include <assert.h>
+#include <fcntl.h>
 #include <grp.h>
+#include <sys/stat.h>
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+#	include <sys/syscall.h>
+#endif
+#ifdef PHPCHUID_HAVE_FSUID
+#	include <sys/fsuid.h>
+#endif
 #include <Zend/zend.h>
 #include <Zend/zend_string.h>
 #include "helpers.h"
+#include "cache.h"
 #include "caps.h"
+#include "metrics.h"
+#include "probes.h"
+#include "ratelimit.h"
+#include "mapfile.h"
+#include "vhosts.h"
+#include "groups.h"
+#include "chroot.h"
+#include "stats.h"
 
 int sapi_is_cli       = -1; /**< Whether SAPI is CLI */
 int sapi_is_cgi       = -1; /**< Whether SAPI is CGI */
+int sapi_has_user_ini = -1; /**< Whether SAPI takes per-directory settings only from php.ini and user INI files */
+int sapi_is_fpm       = -1; /**< Whether SAPI is FPM */
 #ifdef ZTS
 int sapi_is_supported = -1; /**< Whether SAPI is supported */
 #endif
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+int use_thread_credentials = 0; /**< Whether the credentials are changed with raw system calls (set in MINIT from @c chuid.thread_credentials) */
+
+/* 32-bit x86 and ARM keep the legacy 16-bit ID system calls under the plain names */
+#	ifdef SYS_setresuid32
+#		define CHUID_SYS_SETRESUID SYS_setresuid32
+#		define CHUID_SYS_SETRESGID SYS_setresgid32
+#		define CHUID_SYS_SETGROUPS SYS_setgroups32
+#	else
+#		define CHUID_SYS_SETRESUID SYS_setresuid
+#		define CHUID_SYS_SETRESGID SYS_setresgid
+#		define CHUID_SYS_SETGROUPS SYS_setgroups
+#	endif
+#endif
+
+#ifdef ZTS
+/**
+ * @brief State computed in MINIT; the threads started later copy it in @c init_thread_state()
+ *
+ * The globals of a new thread are constructed from the INI settings, not from the globals of the thread which ran MINIT.
+ */
+static struct {
+	enum change_xid_mode_t mode; /**< @c chuid_globals.mode */
+	zend_bool active;            /**< @c chuid_globals.active */
+	zend_bool per_req_chroot;    /**< @c chuid_globals.per_req_chroot */
+	zend_bool defer_restore;     /**< @c chuid_globals.defer_restore */
+	int root_fd;                 /**< @c chuid_globals.root_fd */
+	uid_t ruid;                  /**< @c chuid_globals.ruid */
+	uid_t euid;                  /**< @c chuid_globals.euid */
+	gid_t rgid;                  /**< @c chuid_globals.rgid */
+	gid_t egid;                  /**< @c chuid_globals.egid */
+} thread_template = { cxm_setuid, 0, 0, 0, -1, 0, 0, 0, 0 };
+#endif
+
+#if PHP_VERSION_ID < 70200
+typedef void (*zif_handler)(INTERNAL_FUNCTION_PARAMETERS);
+#endif
+
+/**
+ * @brief Functions disabled by @c disable_posix_setuids()
+ */
+static const char* const blacklisted_functions[] = {
+	"posix_setegid",
+	"posix_seteuid",
+	"posix_setgid",
+	"posix_setuid",
+	"pcntl_setpriority",
+	"posix_kill",
+	"proc_nice"
+};
+
+/**
+ * @brief Number of elements in @c blacklisted_functions
+ */
+#define NUM_BLACKLISTED_FUNCTIONS (sizeof(blacklisted_functions)/sizeof(blacklisted_functions[0]))
+
+#ifdef PHPCHUID_HAVE_FSUID
+/**
+ * @brief Functions which run other programs, signal other processes or change their priority; the effective UID stays 0 with @c chuid.mode=fsuid
+ */
+static const char* const fs_unsafe_functions[] = {
+	"exec",
+	"mail",
+	"mb_send_mail",
+	"passthru",
+	"pcntl_exec",
+	"pcntl_setpriority",
+	"popen",
+	"posix_kill",
+	"proc_open",
+	"shell_exec",
+	"system"
+};
 
 /**
- * @brief Hash table with the names of the blacklisted functions
- * @note Gets populated in @c disable_posix_setuids() and destroyed in @c zm_shutdown_chuid() only if <code>CHUID_G(disable_setuid)</code> is not zero.
+ * @brief Capabilities lowered while a request runs with @c chuid.mode=fsuid; @c CAP_SETGID only in @c cxm_setfsxid
  */
-HashTable blacklisted_functions;
+static cap_value_t fs_request_caps[] = { CAP_SETUID, CAP_SETGID };
+#endif
 
 /**
- * @brief Saved @c zend_execute_internal()
- * @note Initialized in @c disable_posix_setuids() and restored in @c zm_shutdown_chuid() only if <code>CHUID_G(disable_setuid)</code> is not zero.
+ * @brief Original handlers of the disabled functions
+ * @note Populated in @c disable_posix_setuids() and restored in @c restore_posix_setuids(); @c NULL if the function does not exist
  */
-void (*old_execute_internal)(zend_execute_data*, zval*);
+static zif_handler saved_handlers[NUM_BLACKLISTED_FUNCTIONS];
 
 /**
  * @brief @c nobody user ID
@@ -41,31 +133,41 @@ uid_t uid_nobody = 65534;
 gid_t gid_nogroup = 65534;
 
 /**
- * @brief Function execution handler
- * @param execute_data_ptr Zend Execute Data
- * @param return_value_used Whether the return value is used
+ * @brief Replacement handler for the disabled functions
+ * @param execute_data Zend Execute Data
+ * @param return_value Return value
  */
-static void chuid_execute_internal(zend_execute_data* execute_data_ptr, zval* return_value)
+static ZEND_FUNCTION(chuid_disabled_function)
 {
-	zend_string* fname   = execute_data_ptr->func->common.function_name;
-	zend_class_entry* ce = execute_data_ptr->func->common.scope;
+	zend_error(E_ERROR, "%s() has been disabled for security reasons", get_active_function_name());
+}
 
-	if (NULL == ce && 0 != CHUID_G(disable_setuid)) {
-		int res;
-		res = fname ? zend_hash_exists(&blacklisted_functions, fname) : 0;
+/**
+ * With @c chuid.mode=fsuid, only the filesystem UID is changed; the real, effective and saved UIDs stay as they are.
+ * With @c chuid.thread_credentials, the system call is made directly: glibc's @c setresuid() changes the credentials
+ * of all threads of the process, the system call changes only those of the calling thread.
+ */
+int my_setuids(uid_t ruid, uid_t euid, enum change_xid_mode_t mode)
+{
+#ifdef PHPCHUID_HAVE_FSUID
+	if (cxm_setfsuid == mode || cxm_setfsxid == mode) {
+		/* setfsuid() does not report errors; setfsuid(-1) fails and returns the current value */
+		setfsuid(euid);
+		return ((uid_t)setfsuid((uid_t)-1) == euid) ? 0 : (errno = EPERM, -1);
+	}
+#endif
 
-		if (0 != res) {
-			zend_error(E_ERROR, "%s() has been disabled for security reasons", get_active_function_name());
-			zend_bailout();
-			return;
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+	if (use_thread_credentials) {
+		if (cxm_setuid == mode || cxm_setxid == mode) {
+			/* Like setuid() as root, drop the saved UID as well */
+			return (int)syscall(CHUID_SYS_SETRESUID, euid, euid, euid);
 		}
-	}
 
-	old_execute_internal(execute_data_ptr, return_value);
-}
+		return (int)syscall(CHUID_SYS_SETRESUID, ruid, euid, 0);
+	}
+#endif
 
-int my_setuids(uid_t ruid, uid_t euid, enum change_xid_mode_t mode)
-{
 	if (cxm_setuid == mode || cxm_setxid == mode) {
 		return setuid(euid);
 	}
@@ -75,6 +177,23 @@ int my_setuids(uid_t ruid, uid_t euid, enum change_xid_mode_t mode)
 
 int my_setgids(gid_t rgid, gid_t egid, enum change_xid_mode_t mode)
 {
+#ifdef PHPCHUID_HAVE_FSUID
+	if (cxm_setfsxid == mode) {
+		setfsgid(egid);
+		return ((gid_t)setfsgid((gid_t)-1) == egid) ? 0 : (errno = EPERM, -1);
+	}
+#endif
+
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+	if (use_thread_credentials) {
+		if (cxm_setxid == mode) {
+			return (int)syscall(CHUID_SYS_SETRESGID, egid, egid, egid);
+		}
+
+		return (int)syscall(CHUID_SYS_SETRESGID, rgid, egid, 0);
+	}
+#endif
+
 	if (cxm_setxid == mode) {
 		return setgid(egid);
 	}
@@ -82,9 +201,77 @@ int my_setgids(gid_t rgid, gid_t egid, enum change_xid_mode_t mode)
 	return setresgid(rgid, egid, 0);
 }
 
+int my_setgroups(size_t size, const gid_t* list)
+{
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+	if (use_thread_credentials) {
+		return (int)syscall(CHUID_SYS_SETGROUPS, size, list);
+	}
+#endif
+
+	return setgroups(size, list);
+}
+
+#ifdef ZTS
+void save_thread_template(void)
+{
+	thread_template.mode           = CHUID_G(mode);
+	thread_template.active         = CHUID_G(active);
+	thread_template.per_req_chroot = CHUID_G(per_req_chroot);
+	thread_template.defer_restore  = CHUID_G(defer_restore);
+	thread_template.root_fd        = CHUID_G(root_fd);
+	thread_template.ruid           = CHUID_G(ruid);
+	thread_template.euid           = CHUID_G(euid);
+	thread_template.rgid           = CHUID_G(rgid);
+	thread_template.egid           = CHUID_G(egid);
+}
+
+/**
+ * A thread inherits the credentials of the thread which created it. If that thread was serving a request
+ * (the servers which start threads on demand do that), the new thread starts with the credentials of that request;
+ * they are replaced with the original ones, which is possible because the saved UID stays 0.
+ *
+ * In CLI and CGI, the credentials are changed irreversibly: the threads started by a script (e.g., those of ext/parallel)
+ * cannot switch and keep the credentials of the script.
+ */
+void init_thread_state(void)
+{
+	uid_t ruid;
+	uid_t euid;
+	uid_t suid;
+	gid_t rgid;
+	gid_t egid;
+	gid_t sgid;
+
+	CHUID_G(thread_ready)   = 1;
+	CHUID_G(mode)           = thread_template.mode;
+	CHUID_G(active)         = thread_template.active;
+	CHUID_G(per_req_chroot) = thread_template.per_req_chroot;
+	CHUID_G(defer_restore)  = thread_template.defer_restore;
+	CHUID_G(root_fd)        = thread_template.root_fd;
+	CHUID_G(ruid)           = thread_template.ruid;
+	CHUID_G(euid)           = thread_template.euid;
+	CHUID_G(rgid)           = thread_template.rgid;
+	CHUID_G(egid)           = thread_template.egid;
+
+	if (CHUID_G(active) && 0 == getresuid(&ruid, &euid, &suid) && 0 == getresgid(&rgid, &egid, &sgid)) {
+		if (ruid != CHUID_G(ruid) || euid != CHUID_G(euid) || rgid != CHUID_G(rgid) || egid != CHUID_G(egid)) {
+			if (cxm_setuid == CHUID_G(mode) || cxm_setxid == CHUID_G(mode)) {
+				CHUID_G(active) = 0;
+			}
+			else {
+				restore_guids(E_CORE_ERROR);
+			}
+		}
+	}
+}
+#endif
+
 /**
  * @details Disables @c posix_setegid(), @c posix_seteuid(), @c posix_setgid() and @c posix_setuid() functions
  * if @c chuid_globals.disable_setuid is not zero
+ * by replacing their handlers in the function table. This is done once in MINIT, therefore the check costs nothing
+ * on the internal function call path.
  * @note If @c HAVE_SETRESUID constant is not defined (i.e., the system does not have @c setresuid() call)
  * and the extension is build without @c libcap or @c libcap-ng support, @c posix_kill(), @c pcntl_setpriority() and @c proc_nice()
  * functions are also disabled, because @c seteuid() changes only the effective UID,
@@ -93,25 +280,87 @@ int my_setgids(gid_t rgid, gid_t egid, enum change_xid_mode_t mode)
 void disable_posix_setuids()
 {
 	if (0 != CHUID_G(disable_setuid)) {
-		zval dummy;
-		ZVAL_LONG(&dummy, 1);
-		zend_hash_init(&blacklisted_functions, 8, NULL, NULL, 1);
-		zend_hash_str_add(&blacklisted_functions, "posix_setegid",     sizeof("posix_setegid")-1,     &dummy);
-		zend_hash_str_add(&blacklisted_functions, "posix_seteuid",     sizeof("posix_seteuid")-1,     &dummy);
-		zend_hash_str_add(&blacklisted_functions, "posix_setgid",      sizeof("posix_setgid")-1,      &dummy);
-		zend_hash_str_add(&blacklisted_functions, "posix_setuid",      sizeof("posix_setuid")-1,      &dummy);
-		zend_hash_str_add(&blacklisted_functions, "pcntl_setpriority", sizeof("pcntl_setpriority")-1, &dummy);
-		zend_hash_str_add(&blacklisted_functions, "posix_kill",        sizeof("posix_kill")-1,        &dummy);
-		zend_hash_str_add(&blacklisted_functions, "proc_nice",         sizeof("proc_nice")-1,         &dummy);
-
-		old_execute_internal = zend_execute_internal;
-		if (NULL == old_execute_internal) {
-			old_execute_internal = execute_internal;
+		size_t i;
+
+		for (i=0; i<NUM_BLACKLISTED_FUNCTIONS; ++i) {
+			const char* name  = blacklisted_functions[i];
+			zend_function* fn = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+
+			if (fn && ZEND_INTERNAL_FUNCTION == fn->type) {
+				saved_handlers[i]             = fn->internal_function.handler;
+				fn->internal_function.handler = ZEND_FN(chuid_disabled_function);
+			}
+			else {
+				saved_handlers[i] = NULL;
+			}
 		}
+	}
+}
 
-		zend_execute_internal = chuid_execute_internal;
+/**
+ * Puts back the handlers replaced by @c disable_posix_setuids()
+ */
+void restore_posix_setuids()
+{
+	size_t i;
+
+	for (i=0; i<NUM_BLACKLISTED_FUNCTIONS; ++i) {
+		if (saved_handlers[i]) {
+			const char* name  = blacklisted_functions[i];
+			zend_function* fn = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+
+			if (fn && ZEND_FN(chuid_disabled_function) == fn->internal_function.handler) {
+				fn->internal_function.handler = saved_handlers[i];
+			}
+
+			saved_handlers[i] = NULL;
+		}
+	}
+}
+
+#ifdef PHPCHUID_HAVE_FSUID
+/**
+ * @brief Checks whether @c name is in the comma or whitespace separated @c list (the format of @c disable_functions)
+ * @param list List
+ * @param name Function name
+ * @return Whether the function is in the list
+ */
+static int in_function_list(const char* list, const char* name)
+{
+	size_t len = strlen(name);
+
+	while (list && *list) {
+		size_t n;
+
+		list += strspn(list, ", \t\r\n");
+		n     = strcspn(list, ", \t\r\n");
+		if (0 == zend_binary_strcasecmp(list, n, name, len)) {
+			return 1;
+		}
+
+		list += n;
 	}
+
+	return 0;
+}
+
+const char* find_fs_unsafe_function(void)
+{
+	const char* disabled = INI_STR("disable_functions");
+	size_t i;
+
+	for (i=0; i<sizeof(fs_unsafe_functions)/sizeof(fs_unsafe_functions[0]); ++i) {
+		const char* name  = fs_unsafe_functions[i];
+		zend_function* fn = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+
+		if (fn && ZEND_INTERNAL_FUNCTION == fn->type && ZEND_FN(chuid_disabled_function) != fn->internal_function.handler && !in_function_list(disabled, name)) {
+			return name;
+		}
+	}
+
+	return NULL;
 }
+#endif
 
 /**
  * @note If the call to @c chroot() succeeds, the function immediately <code>chdir()</code>'s to the target directory
@@ -122,86 +371,405 @@ int do_chroot(const char* root)
 	if (root && *root && '/' == *root) {
 		int res;
 
-		res = chdir(root);  if (res) { PHPCHUID_ERROR(E_CORE_ERROR, "chdir(\"%s\"): %s", root, strerror(errno));  return FAILURE; }
-		res = chroot(root); if (res) { PHPCHUID_ERROR(E_CORE_ERROR, "chroot(\"%s\"): %s", root, strerror(errno)); return FAILURE; }
+		res = chdir(root);  if (res) { PHPCHUID_ERROR(E_CORE_ERROR, "chdir(\"%s\"): %s", root, strerror(errno));  CHUID_PROBE2(chroot, root, res); return FAILURE; }
+		res = chroot(root); if (res) { PHPCHUID_ERROR(E_CORE_ERROR, "chroot(\"%s\"): %s", root, strerror(errno)); CHUID_PROBE2(chroot, root, res); return FAILURE; }
+		CHUID_PROBE2(chroot, root, 0);
 	}
 
 	return SUCCESS;
 }
 
+/**
+ * The string is persistent because it outlives the request (its value is compared to the root of the next request)
+ */
+void set_jail(const char* root, size_t len)
+{
+	zend_string* jail = CHUID_G(jail);
+
+	if (jail) {
+		if (ZSTR_LEN(jail) == len && !memcmp(ZSTR_VAL(jail), root, len)) {
+			return;
+		}
+
+		zend_string_release(jail);
+	}
+
+	CHUID_G(jail) = zend_string_init(root, len, 1);
+}
 
 /**
- * Sets Real and Effective UIDs to @c uid, Real and Effective GIDs to @c gid, Saved UID and GID to 0
+ * Sets Real and Effective UIDs to @c uid, Real and Effective GIDs to @c gid, Saved UID and GID to 0.
+ * The supplementary groups are cleared, or, if @c chuid.supplementary_groups is on, set to the groups of @c uid from the index built in MINIT.
+ * With @c chuid.mode=fsuid, only the filesystem UID and GID are set.
+ *
+ * If the previous request has left the process with the credentials of its owner (see @c chuid.defer_restore),
+ * and @c uid and @c gid are the same, no system calls are made.
  */
 int set_guids(uid_t uid, gid_t gid)
 {
 	int res;
+	uint64_t start;
 	enum change_xid_mode_t mode = CHUID_G(mode);
 
 	PHPCHUID_DEBUG("set_guids: mode=%d, uid=%d, gid=%d\n", (int)mode, (int)uid, (int)gid);
 
-	if (cxm_setresxid == mode || cxm_setxid == mode) {
-		res = setgroups(0, NULL);
-		if (0 != res) {
-			PHPCHUID_ERROR(E_CORE_WARNING, "Failed to clear the list of supplementary groups: %s", strerror(errno));
+	if (CHUID_G(switched)) {
+		if (uid == CHUID_G(cur_uid) && gid == CHUID_G(cur_gid)) {
+			CHUID_PROBE4(set__guids, uid, gid, (int)mode, 0);
+			return SUCCESS;
+		}
+
+		if (FAILURE == restore_guids(E_CORE_ERROR)) {
+			CHUID_PROBE4(set__guids, uid, gid, (int)mode, -1);
+			return FAILURE;
+		}
+	}
+
+	if (cxm_setresxid == mode || cxm_setxid == mode || cxm_setfsxid == mode) {
+		/* In the fsuid mode, the list is cleared once in MINIT unless it depends on the user */
+		if (cxm_setfsxid != mode || CHUID_G(supplementary_groups)) {
+			const gid_t* groups = NULL;
+			int ngroups         = CHUID_G(supplementary_groups) ? groups_find(uid, &groups) : 0;
+
+			start = stats_start();
+			res   = my_setgroups((size_t)ngroups, groups);
+			stats_stop(cph_setgroups, start);
+			if (0 != res) {
+				metrics_inc(cmt_cred_failures);
+				PHPCHUID_ERROR(E_CORE_WARNING, "Failed to set the list of supplementary groups: %s", strerror(errno));
+			}
 		}
 
-		res = my_setgids(gid, gid, mode);
+		start = stats_start();
+		res   = my_setgids(gid, gid, mode);
+		stats_stop(cph_setgid, start);
 		if (0 != res) {
+			metrics_inc(cmt_cred_failures);
 			PHPCHUID_ERROR(E_CORE_ERROR, "my_setgids(%d, %d, %d): %s", gid, gid, (int)mode, strerror(errno));
+			CHUID_PROBE4(set__guids, uid, gid, (int)mode, res);
 			return FAILURE;
 		}
 	}
 
-	res = my_setuids(uid, uid, mode);
+	start = stats_start();
+	res   = my_setuids(uid, uid, mode);
+	stats_stop(cph_setuid, start);
 	if (0 != res) {
+		metrics_inc(cmt_cred_failures);
 		PHPCHUID_ERROR(E_CORE_ERROR, "my_setuids(%d, %d, %d): %s", uid, uid, (int)mode, strerror(errno));
+		CHUID_PROBE4(set__guids, uid, gid, (int)mode, res);
 		return FAILURE;
 	}
 
+#ifdef PHPCHUID_HAVE_FSUID
+	/* The effective UID is still 0: the request must not be able to change its identity */
+	if ((cxm_setfsuid == mode || cxm_setfsxid == mode) && 0 != set_effective_capabilities(cxm_setfsxid == mode ? 2 : 1, fs_request_caps, 0)) {
+		metrics_inc(cmt_cred_failures);
+		PHPCHUID_ERROR(E_CORE_ERROR, "Failed to lower CAP_SETUID: %s", strerror(errno));
+		CHUID_PROBE4(set__guids, uid, gid, (int)mode, -1);
+		return FAILURE;
+	}
+#endif
+
+	metrics_inc(cmt_switches);
+
+	if (CHUID_G(defer_restore)) {
+		CHUID_G(cur_uid)  = uid;
+		CHUID_G(cur_gid)  = gid;
+		CHUID_G(switched) = 1;
+	}
+
+	CHUID_PROBE4(set__guids, uid, gid, (int)mode, 0);
 	return SUCCESS;
 }
 
-static SAPI_INPUT_FILTER_FUNC(dummy_input_filter)
+int restore_guids(int severity)
+{
+	int res;
+	int retval = SUCCESS;
+	uid_t ruid = CHUID_G(ruid);
+	uid_t euid = CHUID_G(euid);
+	gid_t rgid = CHUID_G(rgid);
+	gid_t egid = CHUID_G(egid);
+	enum change_xid_mode_t mode = CHUID_G(mode);
+
+	CHUID_G(switched) = 0;
+
+#ifdef PHPCHUID_HAVE_FSUID
+	if ((cxm_setfsuid == mode || cxm_setfsxid == mode) && 0 != set_effective_capabilities(cxm_setfsxid == mode ? 2 : 1, fs_request_caps, 1)) {
+		metrics_inc(cmt_cred_failures);
+		PHPCHUID_ERROR(severity, "Failed to raise CAP_SETUID: %s", strerror(errno));
+		retval = FAILURE;
+	}
+#endif
+
+	res = my_setuids(ruid, euid, mode);
+	if (0 != res) {
+		metrics_inc(cmt_cred_failures);
+		PHPCHUID_ERROR(severity, "my_setuids(%d, %d, %d): %s", ruid, euid, (int)mode, strerror(errno));
+		retval = FAILURE;
+	}
+
+	if (cxm_setresxid == mode || cxm_setxid == mode || cxm_setfsxid == mode) {
+		res = my_setgids(rgid, egid, mode);
+		if (0 != res) {
+			metrics_inc(cmt_cred_failures);
+			PHPCHUID_ERROR(severity, "my_setgids(%d, %d, %d): %s", rgid, egid, (int)mode, strerror(errno));
+			retval = FAILURE;
+		}
+	}
+
+	return retval;
+}
+
+/**
+ * @brief Descriptor of @c chuid.docroot_base, -1 if not open
+ */
+static int docroot_base_fd = -1;
+
+/**
+ * @brief Length of @c chuid.docroot_base without the trailing slashes
+ */
+static size_t docroot_base_len = 0;
+
+/**
+ * The directory is opened with @c O_PATH: the descriptor is only used as the starting point of the lookups,
+ * and the lookups do not need the permission to read the directory.
+ */
+int docroot_base_open(const char* base)
+{
+	size_t len = strlen(base);
+	int fd;
+
+	while (len > 1 && '/' == base[len-1]) {
+		--len;
+	}
+
+	if ('/' != *base || 1 == len) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "chuid.docroot_base must be an absolute path other than /: %s", base);
+		return FAILURE;
+	}
+
+	fd = open(
+		base,
+		O_DIRECTORY
+#ifdef O_CLOEXEC
+		| O_CLOEXEC
+#endif
+#ifdef O_PATH
+		| O_PATH
+#else
+		| O_RDONLY
+#endif
+	);
+	if (-1 == fd) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "open(%s): %s", base, strerror(errno));
+		return FAILURE;
+	}
+
+	docroot_base_fd  = fd;
+	docroot_base_len = len;
+	return SUCCESS;
+}
+
+void docroot_base_close(void)
+{
+	if (-1 != docroot_base_fd) {
+		close(docroot_base_fd);
+		docroot_base_fd  = -1;
+		docroot_base_len = 0;
+	}
+}
+
+/**
+ * @brief Gets the owner of @c DOCUMENT_ROOT
+ * @param path @c DOCUMENT_ROOT
+ * @param len Length of @c path
+ * @param uid [out] UID of the owner
+ * @param gid [out] GID of the owner
+ * @return Whether the call succeeded
+ * @retval 0 Yes
+ * @retval -1 No (@c errno will be set)
+ *
+ * The paths below @c chuid.docroot_base are resolved relative to its descriptor, so that the components of the base
+ * are not looked up again. With @c chuid.docroot_statx, @c statx() asks only for the owner and allows the file system
+ * to answer from its cache (@c AT_STATX_DONT_SYNC), which saves a revalidation round trip on NFS and CephFS.
+ */
+static int docroot_owner(const char* path, size_t len, uid_t* uid, gid_t* gid)
+{
+	int dirfd       = AT_FDCWD;
+	const char* rel = path;
+	struct stat statbuf;
+
+	if (-1 != docroot_base_fd && len > docroot_base_len + 1 && '/' == path[docroot_base_len] && !memcmp(path, CHUID_G(docroot_base), docroot_base_len)) {
+		dirfd = docroot_base_fd;
+		rel   = path + docroot_base_len + 1;
+	}
+
+#ifdef HAVE_STATX
+	if (CHUID_G(docroot_statx)) {
+		struct statx stx;
+
+		if (0 != statx(dirfd, rel, AT_STATX_DONT_SYNC, STATX_UID | STATX_GID, &stx)) {
+			return -1;
+		}
+
+		if ((STATX_UID | STATX_GID) == (stx.stx_mask & (STATX_UID | STATX_GID))) {
+			*uid = stx.stx_uid;
+			*gid = stx.stx_gid;
+			return 0;
+		}
+
+		/* The file system could not provide the owner without a full lookup */
+	}
+#endif
+
+	if (0 != fstatat(dirfd, rel, &statbuf, 0)) {
+		return -1;
+	}
+
+	*uid = statbuf.st_uid;
+	*gid = statbuf.st_gid;
+	return 0;
+}
+
+/**
+ * @brief Input filter used to fetch @c DOCUMENT_ROOT from the SAPI
+ *
+ * Rejects everything but @c DOCUMENT_ROOT: SAPIs do not register the variables rejected by the input filter.
+ * This only saves the variables which go through the filter: the environment of the process, imported by
+ * @c php_import_environment_variables(), is copied into the temporary array unfiltered.
+ */
+static SAPI_INPUT_FILTER_FUNC(docroot_input_filter)
 {
 	if (new_val_len) {
 		*new_val_len = val_len;
 	}
 
-	return 1;
+	return PARSE_SERVER == arg && var && !strcmp(var, "DOCUMENT_ROOT");
+}
+
+/**
+ * @brief Sets the identity of the request, honoring @c chuid.never_root
+ * @param u UID
+ * @param g GID
+ * @param uid [in,out] UID; defaults on input
+ * @param gid [in,out] GID; defaults on input
+ */
+static void set_identity(uid_t u, gid_t g, uid_t* uid, gid_t* gid)
+{
+	if (!CHUID_G(never_root) || 0 != u) {
+		*uid = u;
+	}
+
+	if (!CHUID_G(never_root) || 0 != g) {
+		*gid = g;
+	}
+}
+
+/**
+ * @brief Gets the default identity of the request (@c chuid.default_uid / @c chuid.default_gid)
+ * @param uid [out] UID
+ * @param gid [out] GID
+ */
+static void default_identity(uid_t* uid, gid_t* gid)
+{
+	*gid = (gid_t)CHUID_G(default_gid);
+	*uid = (uid_t)CHUID_G(default_uid);
+
+	if (65534 == *uid) {
+		*uid = uid_nobody;
+		*gid = gid_nogroup;
+	}
+}
+
+/**
+ * @brief Looks up the identity of the request in @c chuid.map_file
+ * @param path Path to look up
+ * @param len Length of @c path
+ * @param uid [in,out] UID; defaults on input
+ * @param gid [in,out] GID; defaults on input
+ * @return Whether the path has been found
+ * @retval SUCCESS Yes
+ * @retval FAILURE No
+ */
+static int lookup_map(const char* path, size_t len, uid_t* uid, gid_t* gid)
+{
+	uid_t u;
+	gid_t g;
+
+	if (FAILURE == map_file_lookup(path, len, &u, &g, &CHUID_G(map_chroot), &CHUID_G(map_chroot_len))) {
+		return FAILURE;
+	}
+
+	set_identity(u, g, uid, gid);
+
+	CHUID_PROBE5(docroot, path, *uid, *gid, 0, 1);
+	return SUCCESS;
 }
 
 /**
  * Tries to get UID and GID of the owner of the @c DOCUMENT_ROOT.
  * If @c stat() fails on the @c DOCUMENT_ROOT or @c DOCUMENT_ROOT is not set, defaults are used.
  * If default UID is 65534, UID and GID are set to @c nobody and @c nogroup
+ *
+ * The outcome of @c stat() (including failures) is cached if @c chuid.docroot_cache_ttl is positive.
+ *
+ * If @c chuid.map_file is set, @c DOCUMENT_ROOT (or @c SCRIPT_FILENAME if @c chuid.map_use_script_filename is on)
+ * is looked up in the map first, and @c stat() is only used for the paths which are not in the map.
+ * If @c chuid.vhost_file is set, the host name of the request is looked up before everything else.
+ *
+ * If the process still has the credentials of the previous request (@c chuid.defer_restore), they are restored
+ * before the file system is accessed.
  */
 void get_docroot_guids(uid_t* uid, gid_t* gid)
 {
 	char* docroot = NULL;
 	char* docroot_corrected;
+	size_t len;
 	int res;
-	struct stat statbuf;
+	int error;
+	uint64_t start;
+	uid_t owner_uid;
+	gid_t owner_gid;
 	zval server;
 
 	assert(uid != NULL);
 	assert(gid != NULL);
 
 	ZVAL_UNDEF(&server);
+	default_identity(uid, gid);
 
-	*gid = (gid_t)CHUID_G(default_gid);
-	*uid = (uid_t)CHUID_G(default_uid);
+	CHUID_G(map_chroot) = NULL;
+	if (vhosts_loaded()) {
+		uid_t u;
+		gid_t g;
 
-	if (65534 == *uid) {
-		*uid = uid_nobody;
-		*gid = gid_nogroup;
+		if (SUCCESS == vhosts_lookup(&u, &g)) {
+			set_identity(u, g, uid, gid);
+			CHUID_PROBE5(docroot, NULL, *uid, *gid, 0, 1);
+			return;
+		}
+	}
+
+	if (CHUID_G(map_use_script_filename) && map_file_loaded() && SG(request_info).path_translated) {
+		const char* script = SG(request_info).path_translated;
+
+		if (SUCCESS == lookup_map(script, strlen(script), uid, gid)) {
+			return;
+		}
 	}
 
 	if (NULL != sapi_module.getenv) {
 		docroot = sapi_module.getenv(ZEND_STRL("DOCUMENT_ROOT"));
 	}
 
-	if (NULL == docroot && NULL != sapi_module.register_server_variables) {
+	if (sapi_is_cli) {
+		/* CLI and phpdbg have no getenv(); they register an empty DOCUMENT_ROOT over the one from the environment */
+		docroot = "";
+	}
+	else if (NULL == docroot && (!sapi_has_user_ini || sapi_is_fpm) && NULL != sapi_module.register_server_variables) {
+		/* php-cgi looks in both the FastCGI parameters and the environment in getenv(), so there is nothing else to find; FPM does not look in the environment */
 		zval* value;
 		zval old_server = PG(http_globals)[TRACK_VARS_SERVER];
 #if PHP_MAJOR_VERSION >= 8
@@ -209,7 +777,7 @@ void get_docroot_guids(uid_t* uid, gid_t* gid)
 #else
 		unsigned int (*orig_input_filter)(int, char*, char**, size_t, size_t*) = sapi_module.input_filter;
 #endif
-		sapi_module.input_filter = dummy_input_filter;
+		sapi_module.input_filter = docroot_input_filter;
 
 		array_init(&server);
 		PG(http_globals)[TRACK_VARS_SERVER] = server;
@@ -225,85 +793,152 @@ void get_docroot_guids(uid_t* uid, gid_t* gid)
 	}
 
 	if (NULL == docroot) {
-		PHPCHUID_ERROR(E_WARNING, "%s", "Cannot get DOCUMENT_ROOT");
+		metrics_inc(cmt_default_fallbacks);
+		report_docroot_error(NULL, 0, 0);
+		CHUID_PROBE5(docroot, NULL, *uid, *gid, -1, 0);
 		zval_ptr_dtor(&server);
 		return;
 	}
 
 	docroot_corrected = (*docroot) ? docroot : "/";
+	len               = strlen(docroot_corrected);
+
+	if (!CHUID_G(map_use_script_filename) && map_file_loaded() && SUCCESS == lookup_map(docroot_corrected, len, uid, gid)) {
+		zval_ptr_dtor(&server);
+		return;
+	}
+
+	if (SUCCESS == docroot_cache_find(docroot_corrected, len, uid, gid, &error)) {
+		if (0 != error) {
+			metrics_inc(cmt_default_fallbacks);
+			report_docroot_error(docroot_corrected, len, error);
+		}
+
+		CHUID_PROBE5(docroot, docroot_corrected, *uid, *gid, error, 1);
+		zval_ptr_dtor(&server);
+		return;
+	}
+
+	if (CHUID_G(in_jail)) {
+		/* DOCUMENT_ROOT is a path on the real file system */
+		leave_jail(E_CORE_ERROR);
+	}
+
+	if (CHUID_G(switched)) {
+		/* Only the memory lookups above may run with the credentials left by the previous request (chuid.defer_restore) */
+		restore_guids(E_CORE_ERROR);
+	}
+
+	start = stats_start();
+	res   = docroot_owner(docroot_corrected, len, &owner_uid, &owner_gid);
+	stats_stop(cph_stat, start);
 
-	res = stat(docroot_corrected, &statbuf);
 	if (0 != res) {
-		PHPCHUID_ERROR(E_WARNING, "stat(%s): %s", docroot_corrected, strerror(errno));
+		error = errno;
+		docroot_cache_add(docroot_corrected, len, *uid, *gid, error);
+		metrics_inc(cmt_default_fallbacks);
+		report_docroot_error(docroot_corrected, len, error);
+		CHUID_PROBE5(docroot, docroot_corrected, *uid, *gid, error, 0);
 		zval_ptr_dtor(&server);
 		return;
 	}
 
+	set_identity(owner_uid, owner_gid, uid, gid);
+	docroot_cache_add(docroot_corrected, len, *uid, *gid, 0);
+	CHUID_PROBE5(docroot, docroot_corrected, *uid, *gid, 0, 0);
 	zval_ptr_dtor(&server);
+}
 
-	if (CHUID_G(never_root)) {
-		if (0 != statbuf.st_uid) {
-			*uid = statbuf.st_uid;
-		}
+/**
+ * Stores the same entry as @c get_docroot_guids() would on a cache miss, without reporting the errors:
+ * a failed @c stat() is cached as well, and the requests report it.
+ */
+int prewarm_docroot_guids(const char* docroot, size_t len)
+{
+	uid_t uid;
+	gid_t gid;
+	uid_t owner_uid;
+	gid_t owner_gid;
+	int error = 0;
+
+	if (CHUID_G(docroot_cache_ttl) <= 0) {
+		return 0;
+	}
 
-		if (0 != statbuf.st_gid) {
-			*gid = statbuf.st_gid;
-		}
+	default_identity(&uid, &gid);
+	if (0 == docroot_owner(docroot, len, &owner_uid, &owner_gid)) {
+		set_identity(owner_uid, owner_gid, &uid, &gid);
 	}
 	else {
-		*uid = statbuf.st_uid;
-		*gid = statbuf.st_gid;
+		error = errno;
 	}
+
+	docroot_cache_add(docroot, len, uid, gid, error);
+	return error;
+}
+
+/**
+ * @brief Checks whether a worker has to do something outside of the jail between the requests
+ * @return Whether the metrics file, the summary of the suppressed warnings or the supplementary groups index is due
+ */
+static int housekeeping_due(void)
+{
+	if (metrics_export_due() || ratelimit_flush_due()) {
+		return 1;
+	}
+
+#ifndef ZTS
+	if ((!CHUID_G(global_chroot) || !*CHUID_G(global_chroot)) && groups_index_refresh_due()) {
+		return 1;
+	}
+#endif
+
+	return 0;
 }
 
 /**
  * If the module is active, sets back the original UID/GID and depending on the ini settings, escapes the chroot.
+ * If @c chuid.defer_restore is on, the original UID/GID are restored by the next call to @c set_guids() instead.
+ * If @c chuid.stay_in_jail is on, the per-request @c chroot is left by the next request, and only if it has to;
+ * the process leaves it right away when the metrics file, the warnings summary or the groups index is due.
  */
 void deactivate()
 {
 	PHPCHUID_DEBUG("%s\n", "deactivate");
 
 	if (1 == CHUID_G(active)) {
-		int res;
-		uid_t ruid = CHUID_G(ruid);
-		uid_t euid = CHUID_G(euid);
-		gid_t rgid = CHUID_G(rgid);
-		gid_t egid = CHUID_G(egid);
-		enum change_xid_mode_t mode = CHUID_G(mode);
+		int restored   = SUCCESS;
+		int escaped    = 0;
+		uint64_t start = stats_start();
 
-		res = my_setuids(ruid, euid, mode);
-		if (0 != res) {
-			PHPCHUID_ERROR(E_ERROR, "my_setuids(%d, %d, %d): %s", ruid, euid, (int)mode, strerror(errno));
+		if (!CHUID_G(defer_restore)) {
+			restored = restore_guids(E_ERROR);
 		}
 
-		if (cxm_setresxid == mode || cxm_setxid == mode) {
-			res = my_setgids(rgid, egid, mode);
-			if (0 != res) {
-				PHPCHUID_ERROR(E_ERROR, "my_setgids(%d, %d, %d): %s", rgid, egid, (int)mode, strerror(errno));
+		if (CHUID_G(per_req_chroot)) {
+			if (CHUID_G(stay_in_jail) && CHUID_G(chrooted) && !housekeeping_due()) {
+				/* The next request leaves the jail if it needs another root or the real file system */
+				CHUID_G(in_jail) = 1;
+			}
+			else {
+				escaped = leave_jail(E_ERROR);
 			}
 		}
 
-		if (CHUID_G(per_req_chroot)) {
-			int res;
+		CHUID_PROBE2(deactivate, restored, escaped);
 
-			res = fchdir(CHUID_G(root_fd));
-			if (res) {
-				PHPCHUID_ERROR(E_ERROR, "fchdir() failed: %s", strerror(errno));
-			}
-			else {
-				res = chroot(".");
-				if (res) {
-					PHPCHUID_ERROR(E_ERROR, "chroot(\".\") failed: %s", strerror(errno));
-				}
+		/* Inside the jail, the paths would be resolved relative to it */
+		if (!CHUID_G(switched) && !CHUID_G(in_jail)) {
+			metrics_export(0);
+			ratelimit_flush(0);
+#ifndef ZTS
+			if (!CHUID_G(global_chroot) || !*CHUID_G(global_chroot)) {
+				/* NSS would read the databases of the chroot */
+				groups_index_maybe_refresh();
 			}
+#endif
 		}
-	}
-}
 
-zend_bool chuid_is_auto_global(const char* name, size_t len)
-{
-	zend_string* n = zend_string_init(name, len, 0);
-	zend_bool res  = zend_is_auto_global(n);
-	zend_string_release(n);
-	return res;
+		stats_stop(cph_deactivate, start);
+	}
 }
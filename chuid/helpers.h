@@ -32,11 +32,47 @@ PHPCHUID_VISIBILITY_HIDDEN int my_setuids(uid_t ruid, uid_t euid, enum change_xi
  */
 PHPCHUID_VISIBILITY_HIDDEN int my_setgids(gid_t rgid, gid_t egid, enum change_xid_mode_t mode);
 
+/**
+ * @brief Sets the list of supplementary groups
+ * @param size Number of elements in @c list
+ * @param list Groups
+ * @return Whether call succeeded
+ * @retval 0 Yes
+ * @retval -1 No (@c errno will be set)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int my_setgroups(size_t size, const gid_t* list);
+
+#ifdef ZTS
+/**
+ * @brief Remembers the state computed in MINIT for the threads started later
+ */
+PHPCHUID_VISIBILITY_HIDDEN void save_thread_template(void);
+
+/**
+ * @brief Copies the state computed in MINIT into the globals of the current thread
+ */
+PHPCHUID_VISIBILITY_HIDDEN void init_thread_state(void);
+#endif
+
 /**
  * @brief Disables <code>posix_set{e,}{u,g}id()</code> PHP functions if told by @c chuid.disable_posix_setuid_family
  */
 PHPCHUID_VISIBILITY_HIDDEN void disable_posix_setuids();
 
+/**
+ * @brief Re-enables the functions disabled by @c disable_posix_setuids()
+ */
+PHPCHUID_VISIBILITY_HIDDEN void restore_posix_setuids();
+
+#ifdef PHPCHUID_HAVE_FSUID
+/**
+ * @brief Finds a function which would run a program or signal a process as root with @c chuid.mode=fsuid
+ * @return Name of the first such function which is neither in @c disable_functions nor disabled by chuid, @c NULL if there is none
+ * @note Must be called in MINIT after @c disable_posix_setuids(), before PHP applies @c disable_functions
+ */
+PHPCHUID_VISIBILITY_HIDDEN const char* find_fs_unsafe_function(void);
+#endif
+
 /**
  * @brief <code>chroot()</code>'s to the directory specified by the @c root parameter
  * @param root New root directory
@@ -46,6 +82,14 @@ PHPCHUID_VISIBILITY_HIDDEN void disable_posix_setuids();
  */
 PHPCHUID_VISIBILITY_HIDDEN int do_chroot(const char* root);
 
+/**
+ * @brief Remembers the root directory of the current request
+ * @param root Root directory
+ * @param len Length of @c root without the trailing slash
+ * @see @c zend_chuid_globals.jail
+ */
+PHPCHUID_VISIBILITY_HIDDEN void set_jail(const char* root, size_t len);
+
 /**
  * @brief Sets RUID/EUID/SUID and RGID/EGID/SGID
  * @param uid Real and Effective UID
@@ -56,6 +100,29 @@ PHPCHUID_VISIBILITY_HIDDEN int do_chroot(const char* root);
  */
 PHPCHUID_VISIBILITY_HIDDEN int set_guids(uid_t uid, gid_t gid);
 
+/**
+ * @brief Restores the original RUID/EUID and RGID/EGID
+ * @param severity Severity of the error to report if a call fails
+ * @return Whether calls to <code>my_setuids()</code>/<code>my_setgids()</code> were successful
+ * @retval SUCCESS OK
+ * @retval FAILURE Failure
+ */
+PHPCHUID_VISIBILITY_HIDDEN int restore_guids(int severity);
+
+/**
+ * @brief Opens @c chuid.docroot_base
+ * @param base Path to the common parent directory of the document roots
+ * @return Whether the call succeeded
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the error has been reported)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int docroot_base_open(const char* base);
+
+/**
+ * @brief Closes the descriptor opened by @c docroot_base_open()
+ */
+PHPCHUID_VISIBILITY_HIDDEN void docroot_base_close(void);
+
 /**
  * @brief Gets <code>DOCUMENT_ROOT</code>'s owner UID and GID
  * @param uid [out] UID to set
@@ -64,12 +131,18 @@ PHPCHUID_VISIBILITY_HIDDEN int set_guids(uid_t uid, gid_t gid);
  */
 PHPCHUID_VISIBILITY_HIDDEN void get_docroot_guids(uid_t* uid, gid_t* gid);
 
+/**
+ * @brief Puts the owner of the document root into the @c DOCUMENT_ROOT cache
+ * @param docroot Document root, as the SAPI passes it
+ * @param len Length of @c docroot
+ * @return 0 on success, @c errno of the failed @c stat() otherwise
+ * @note Does nothing unless @c chuid.docroot_cache_ttl is positive
+ */
+PHPCHUID_VISIBILITY_HIDDEN int prewarm_docroot_guids(const char* docroot, size_t len);
+
 /**
  * @brief Deactivation function
  */
 PHPCHUID_VISIBILITY_HIDDEN void deactivate();
 
-
-PHPCHUID_VISIBILITY_HIDDEN zend_bool chuid_is_auto_global(const char* name, size_t len);
-
 #endif /* PHPCHUID_HELPERS_H_ */
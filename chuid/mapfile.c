@@ -0,0 +1,277 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Precompiled path prefix → identity map — implementation
+ *
+ * File layout (all integers are 32-bit unsigned in the host byte order):
+ * <TABLE>
+ * <TR><TD>Header</TD><TD>@c map_header</TD></TR>
+ * <TR><TD>Nodes</TD><TD>@c map_node[nodes_count]; node 0 is the root (the empty prefix)</TD></TR>
+ * <TR><TD>Edges</TD><TD>@c map_edge[edges_count]; the edges of a node are contiguous and sorted by the first byte of the label</TD></TR>
+ * <TR><TD>Values</TD><TD>@c map_value[values_count]</TD></TR>
+ * <TR><TD>Strings</TD><TD>Edge labels and NUL-terminated @c chroot paths</TD></TR>
+ * </TABLE>
+ *
+ * The whole file is validated once when it is mapped, so that the lookups do not need any bounds checks.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapfile.h"
+
+/**
+ * @brief File signature (includes the format version)
+ */
+#define MAP_MAGIC "CHUIDMP1"
+
+/**
+ * @brief "No @c chroot" marker of @c map_value::chroot_off
+ */
+#define MAP_NO_CHROOT 0xFFFFFFFFu
+
+/**
+ * @brief File header
+ */
+typedef struct _map_header {
+	char magic[8];          /**< @c MAP_MAGIC */
+	uint32_t nodes_off;     /**< Offset of the nodes */
+	uint32_t nodes_count;   /**< Number of the nodes */
+	uint32_t edges_off;     /**< Offset of the edges */
+	uint32_t edges_count;   /**< Number of the edges */
+	uint32_t values_off;    /**< Offset of the values */
+	uint32_t values_count;  /**< Number of the values */
+	uint32_t strings_off;   /**< Offset of the string pool */
+	uint32_t strings_size;  /**< Size of the string pool */
+} map_header;
+
+/**
+ * @brief Trie node
+ */
+typedef struct _map_node {
+	uint32_t value;         /**< Index of the value plus one; 0 if the prefix ending at this node is not in the map */
+	uint32_t first_edge;    /**< Index of the first edge */
+	uint32_t num_edges;     /**< Number of the edges */
+	uint32_t reserved;      /**< Reserved, 0 */
+} map_node;
+
+/**
+ * @brief Trie edge
+ */
+typedef struct _map_edge {
+	uint32_t label_off;     /**< Offset of the label in the string pool */
+	uint32_t label_len;     /**< Length of the label, at least 1 */
+	uint32_t child;         /**< Index of the child node */
+} map_edge;
+
+/**
+ * @brief Identity
+ */
+typedef struct _map_value {
+	uint32_t uid;           /**< UID */
+	uint32_t gid;           /**< GID */
+	uint32_t chroot_off;    /**< Offset of the per-request root in the string pool, @c MAP_NO_CHROOT if none */
+	uint32_t chroot_len;    /**< Length of the per-request root */
+} map_value;
+
+static void* map_base       = NULL;  /**< Mapping */
+static size_t map_size      = 0;     /**< Size of the mapping */
+static const map_node* nodes;        /**< Nodes */
+static const map_edge* edges;        /**< Edges */
+static const map_value* values;      /**< Values */
+static const char* strings;          /**< String pool */
+
+/**
+ * @brief Checks that the array of @c count elements of @c size bytes at @c off lies within the file
+ * @param off Offset
+ * @param count Number of elements
+ * @param size Element size
+ * @return Whether the array is within the file
+ */
+static int in_file(uint32_t off, uint32_t count, size_t size)
+{
+	return off <= map_size && (uint64_t)count * size <= map_size - off && 0 == off % sizeof(uint32_t);
+}
+
+/**
+ * @brief Validates the map
+ * @param hdr Header
+ * @return Whether the map is valid
+ */
+static int validate(const map_header* hdr)
+{
+	uint32_t i;
+
+	if (
+		   !in_file(hdr->nodes_off, hdr->nodes_count, sizeof(map_node))
+		|| !in_file(hdr->edges_off, hdr->edges_count, sizeof(map_edge))
+		|| !in_file(hdr->values_off, hdr->values_count, sizeof(map_value))
+		|| hdr->strings_off > map_size || hdr->strings_size > map_size - hdr->strings_off
+		|| 0 == hdr->nodes_count
+	) {
+		return 0;
+	}
+
+	nodes   = (const map_node*)((const char*)map_base + hdr->nodes_off);
+	edges   = (const map_edge*)((const char*)map_base + hdr->edges_off);
+	values  = (const map_value*)((const char*)map_base + hdr->values_off);
+	strings = (const char*)map_base + hdr->strings_off;
+
+	for (i=0; i<hdr->nodes_count; ++i) {
+		if (nodes[i].value > hdr->values_count || nodes[i].first_edge > hdr->edges_count || nodes[i].num_edges > hdr->edges_count - nodes[i].first_edge) {
+			return 0;
+		}
+	}
+
+	for (i=0; i<hdr->edges_count; ++i) {
+		if (0 == edges[i].label_len || edges[i].label_off > hdr->strings_size || edges[i].label_len > hdr->strings_size - edges[i].label_off || edges[i].child >= hdr->nodes_count) {
+			return 0;
+		}
+	}
+
+	for (i=0; i<hdr->values_count; ++i) {
+		/* (uid_t)-1 and (gid_t)-1 mean "do not change" to setresuid() and friends */
+		if (0xFFFFFFFFu == values[i].uid || 0xFFFFFFFFu == values[i].gid) {
+			return 0;
+		}
+
+		if (MAP_NO_CHROOT != values[i].chroot_off) {
+			/* The path must be followed by NUL */
+			if (values[i].chroot_off > hdr->strings_size || values[i].chroot_len >= hdr->strings_size - values[i].chroot_off || strings[values[i].chroot_off + values[i].chroot_len]) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int map_file_open(const char* path)
+{
+	struct stat st;
+	void* p;
+	int fd = open(
+		path,
+		O_RDONLY
+#ifdef O_CLOEXEC
+		| O_CLOEXEC
+#endif
+	);
+
+	if (-1 == fd) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "open(%s): %s", path, strerror(errno));
+		return FAILURE;
+	}
+
+	if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(map_header)) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "%s is not a valid chuid map file", path);
+		close(fd);
+		return FAILURE;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == p) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "mmap(%s): %s", path, strerror(errno));
+		return FAILURE;
+	}
+
+	map_base = p;
+	map_size = (size_t)st.st_size;
+	if (memcmp(((const map_header*)p)->magic, MAP_MAGIC, sizeof(((map_header*)0)->magic)) || !validate((const map_header*)p)) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "%s is not a valid chuid map file", path);
+		map_file_close();
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+void map_file_close(void)
+{
+	if (map_base) {
+		munmap(map_base, map_size);
+		map_base = NULL;
+		map_size = 0;
+	}
+}
+
+int map_file_loaded(void)
+{
+	return NULL != map_base;
+}
+
+/**
+ * The trie is walked from the root; the edge to follow is found by a binary search on the first byte of the label.
+ * The last node which has a value and ends at a component boundary is the longest matching prefix.
+ */
+int map_file_lookup(const char* path, size_t len, uid_t* uid, gid_t* gid, const char** chroot, size_t* chroot_len)
+{
+	const map_node* node  = nodes;
+	const map_value* best = NULL;
+	size_t pos            = 0;
+
+	if (!map_base) {
+		return FAILURE;
+	}
+
+	for (;;) {
+		const map_edge* e = NULL;
+		uint32_t lo;
+		uint32_t hi;
+		unsigned char c;
+
+		if (node->value && (pos == len || '/' == path[pos])) {
+			best = &values[node->value - 1];
+		}
+
+		if (pos == len) {
+			break;
+		}
+
+		c  = (unsigned char)path[pos];
+		lo = node->first_edge;
+		hi = node->first_edge + node->num_edges;
+		while (lo < hi) {
+			uint32_t mid    = lo + (hi - lo) / 2;
+			unsigned char f = (unsigned char)strings[edges[mid].label_off];
+
+			if (f == c) {
+				e = &edges[mid];
+				break;
+			}
+
+			if (f < c) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+
+		if (!e || e->label_len > len - pos || memcmp(strings + e->label_off, path + pos, e->label_len)) {
+			break;
+		}
+
+		pos += e->label_len;
+		node = &nodes[e->child];
+	}
+
+	if (!best) {
+		return FAILURE;
+	}
+
+	*uid = (uid_t)best->uid;
+	*gid = (gid_t)best->gid;
+	if (MAP_NO_CHROOT != best->chroot_off) {
+		*chroot     = strings + best->chroot_off;
+		*chroot_len = best->chroot_len;
+	}
+	else {
+		*chroot     = NULL;
+		*chroot_len = 0;
+	}
+
+	return SUCCESS;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Precompiled path prefix → identity map — definitions
+ *
+ * The map file is produced by @c tools/chuid-mapc.php from a text file with <code>prefix uid gid [chroot]</code> lines.
+ * It is a radix trie: the file is mapped read-only in MINIT (so that the forked workers share its pages),
+ * and lookups neither allocate memory nor make system calls.
+ */
+
+#ifndef PHPCHUID_MAPFILE_H_
+#define PHPCHUID_MAPFILE_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Maps and validates the map file
+ * @param path Path to the file
+ * @return Whether the call succeeded
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the error has been reported)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int map_file_open(const char* path);
+
+/**
+ * @brief Unmaps the map file
+ */
+PHPCHUID_VISIBILITY_HIDDEN void map_file_close(void);
+
+/**
+ * @brief Whether the map file is loaded
+ * @return Whether the map file is loaded
+ */
+PHPCHUID_VISIBILITY_HIDDEN int map_file_loaded(void);
+
+/**
+ * @brief Finds the longest prefix of @c path in the map
+ * @param path Path (@c DOCUMENT_ROOT or @c SCRIPT_FILENAME)
+ * @param len Length of @c path
+ * @param uid [out] UID
+ * @param gid [out] GID
+ * @param chroot [out] Per-request root of the entry (NUL-terminated, points into the map), @c NULL if the entry has none
+ * @param chroot_len [out] Length of @c chroot
+ * @return Whether a matching entry has been found
+ * @retval SUCCESS Yes
+ * @retval FAILURE No
+ * @note A prefix matches only whole path components: @c /srv/a matches @c /srv/a and @c /srv/a/b but not @c /srv/ab
+ */
+PHPCHUID_VISIBILITY_HIDDEN int map_file_lookup(const char* path, size_t len, uid_t* uid, gid_t* gid, const char** chroot, size_t* chroot_len);
+
+#endif /* PHPCHUID_MAPFILE_H_ */
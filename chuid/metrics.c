@@ -0,0 +1,192 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Metrics shared between worker processes — implementation
+ *
+ * The metrics live in an anonymous shared mapping created before the SAPI forks. Every worker takes its own slot
+ * (cache line aligned, so that the workers do not contend for the same line) and increments its counters with relaxed
+ * atomic additions. The exporter sums the slots. When there are more workers than slots, the slots are shared;
+ * the counters of a worker that has exited stay in its slot, so the sums never go down.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "metrics.h"
+
+/**
+ * @brief Segment header
+ */
+typedef struct _metrics_header {
+	uint32_t next_slot;     /**< Slot to assign to the next worker */
+	int64_t last_export;    /**< When the metrics file was last written */
+} __attribute__((aligned(64))) metrics_header;
+
+/**
+ * @brief Per-worker slot
+ */
+typedef struct _metrics_slot {
+	uint64_t counters[cmt_max]; /**< Counters, indexed by @c chuid_metric_t */
+} __attribute__((aligned(64))) metrics_slot;
+
+/**
+ * @brief Metric names and descriptions, in the order of @c chuid_metric_t
+ */
+static const char* const metric_info[cmt_max][2] = {
+	{ "chuid_requests_total",              "Requests activated by chuid" },
+	{ "chuid_switches_total",              "Requests which changed UID/GID" },
+	{ "chuid_identity_cache_hits_total",   "DOCUMENT_ROOT owner cache hits" },
+	{ "chuid_chroots_total",               "Per-request chroot() entries" },
+	{ "chuid_credential_failures_total",   "Failed credential changing system calls" },
+	{ "chuid_default_uid_fallbacks_total", "Requests run as chuid.default_uid/chuid.default_gid because the owner of DOCUMENT_ROOT could not be determined" },
+	{ "chuid_warnings_suppressed_total",   "Warnings suppressed by chuid.warning_interval" }
+};
+
+#ifdef ZTS
+TSRM_TLS uint64_t* metrics_counters = NULL;
+#else
+uint64_t* metrics_counters = NULL;
+#endif
+
+/**
+ * @brief Segment header; @c NULL if the metrics are disabled
+ */
+static metrics_header* metrics_hdr = NULL;
+
+/**
+ * @brief Slots, follow the header
+ */
+static metrics_slot* metrics_slots = NULL;
+
+/**
+ * @brief Number of elements in @c metrics_slots
+ */
+static size_t metrics_nslots = 0;
+
+int metrics_init(size_t slots)
+{
+	void* p;
+
+	assert(NULL == metrics_hdr);
+
+	p = mmap(NULL, sizeof(metrics_header) + slots * sizeof(metrics_slot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p) {
+		return FAILURE;
+	}
+
+	metrics_hdr    = (metrics_header*)p;
+	metrics_slots  = (metrics_slot*)(metrics_hdr + 1);
+	metrics_nslots = slots;
+	return SUCCESS;
+}
+
+void metrics_destroy(void)
+{
+	if (metrics_hdr) {
+		munmap(metrics_hdr, sizeof(metrics_header) + metrics_nslots * sizeof(metrics_slot));
+		metrics_hdr      = NULL;
+		metrics_slots    = NULL;
+		metrics_nslots   = 0;
+		metrics_counters = NULL;
+	}
+}
+
+void metrics_start_request(void)
+{
+	if (metrics_hdr) {
+		if (UNEXPECTED(NULL == metrics_counters)) {
+			uint32_t slot    = __atomic_fetch_add(&metrics_hdr->next_slot, 1, __ATOMIC_RELAXED);
+			metrics_counters = metrics_slots[slot % metrics_nslots].counters;
+		}
+
+		__atomic_fetch_add(&metrics_counters[cmt_requests], 1, __ATOMIC_RELAXED);
+	}
+}
+
+int metrics_export_due(void)
+{
+	const char* file = CHUID_G(metrics_file);
+
+	return metrics_hdr && file && *file && (int64_t)time(NULL) - __atomic_load_n(&metrics_hdr->last_export, __ATOMIC_RELAXED) >= CHUID_G(metrics_interval);
+}
+
+/**
+ * The file is written to a temporary file first and then renamed, so that the readers never see a partial file.
+ * The temporary file gets a unique name and is created exclusively (@c mkstemp()), so that a file or a symbolic link
+ * planted in the directory cannot be written through. Only one worker writes the file per interval.
+ */
+void metrics_export(int force)
+{
+	const char* file = CHUID_G(metrics_file);
+	int64_t now;
+	int64_t last;
+	uint64_t sums[cmt_max];
+	char tmp[MAXPATHLEN];
+	size_t i;
+	size_t j;
+	FILE* f;
+	int fd;
+
+	if (!metrics_hdr || !file || !*file) {
+		return;
+	}
+
+	now  = (int64_t)time(NULL);
+	last = __atomic_load_n(&metrics_hdr->last_export, __ATOMIC_RELAXED);
+	if (!force && now - last < CHUID_G(metrics_interval)) {
+		return;
+	}
+
+	if (!__atomic_compare_exchange_n(&metrics_hdr->last_export, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) && !force) {
+		return;
+	}
+
+	memset(sums, 0, sizeof(sums));
+	for (i=0; i<metrics_nslots; ++i) {
+		for (j=0; j<cmt_max; ++j) {
+			sums[j] += __atomic_load_n(&metrics_slots[i].counters[j], __ATOMIC_RELAXED);
+		}
+	}
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= sizeof(tmp)) {
+		return;
+	}
+
+#if defined(HAVE_MKOSTEMP) && defined(O_CLOEXEC)
+	fd = mkostemp(tmp, O_CLOEXEC);
+#else
+	fd = mkstemp(tmp);
+	if (-1 != fd) {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	if (-1 == fd) {
+		PHPCHUID_ERROR(E_WARNING, "mkstemp(%s): %s", tmp, strerror(errno));
+		return;
+	}
+
+	/* mkstemp() creates the file with mode 0600; the collector may run as another user */
+	fchmod(fd, 0644);
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	for (j=0; j<cmt_max; ++j) {
+		fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", metric_info[j][0], metric_info[j][1], metric_info[j][0], metric_info[j][0], (unsigned long long)sums[j]);
+	}
+
+	if (0 != fclose(f) || 0 != rename(tmp, file)) {
+		PHPCHUID_ERROR(E_WARNING, "Failed to write %s: %s", file, strerror(errno));
+		unlink(tmp);
+	}
+}
@@ -0,0 +1,82 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Metrics shared between worker processes — definitions
+ */
+
+#ifndef PHPCHUID_METRICS_H_
+#define PHPCHUID_METRICS_H_
+
+#include <stdint.h>
+#include "php_chuid.h"
+
+/**
+ * @brief Counters
+ */
+enum chuid_metric_t {
+	cmt_requests,            /**< Requests activated */
+	cmt_switches,            /**< Requests which changed UID/GID */
+	cmt_cache_hits,          /**< DOCUMENT_ROOT owner cache hits */
+	cmt_chroots,             /**< Per-request @c chroot entries */
+	cmt_cred_failures,       /**< Failed credential changing system calls */
+	cmt_default_fallbacks,   /**< Requests which fell back to @c chuid.default_uid / @c chuid.default_gid because @c DOCUMENT_ROOT could not be resolved */
+	cmt_warnings_suppressed, /**< Warnings suppressed by @c chuid.warning_interval */
+	cmt_max                  /**< Number of counters */
+};
+
+/**
+ * @brief Counters of the current process (thread under ZTS); @c NULL if the metrics are disabled or the process has not served a request yet
+ */
+#ifdef ZTS
+PHPCHUID_VISIBILITY_HIDDEN extern TSRM_TLS uint64_t* metrics_counters;
+#else
+PHPCHUID_VISIBILITY_HIDDEN extern uint64_t* metrics_counters;
+#endif
+
+/**
+ * @brief Creates the shared memory segment
+ * @param slots Number of per-worker slots
+ * @return Whether the call succeeded
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (@c mmap() failed, @c errno will be set)
+ * @note Must be called before the SAPI forks its children (i.e., in MINIT)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int metrics_init(size_t slots);
+
+/**
+ * @brief Destroys the shared memory segment
+ */
+PHPCHUID_VISIBILITY_HIDDEN void metrics_destroy(void);
+
+/**
+ * @brief Counts the request; assigns a slot to the process when it serves its first request
+ * @note The slot cannot be assigned in MINIT, because the workers are forked after that
+ */
+PHPCHUID_VISIBILITY_HIDDEN void metrics_start_request(void);
+
+/**
+ * @brief Writes the metrics file if @c chuid.metrics_interval seconds have passed since it was last written by any worker
+ * @param force Write the file regardless of the interval
+ * @note The process must be able to write to @c chuid.metrics_file, i.e., it must not run with the credentials of the request
+ */
+PHPCHUID_VISIBILITY_HIDDEN void metrics_export(int force);
+
+/**
+ * @brief Checks whether @c metrics_export() would write the file now
+ * @return Whether @c chuid.metrics_interval seconds have passed since the file was last written
+ */
+PHPCHUID_VISIBILITY_HIDDEN int metrics_export_due(void);
+
+/**
+ * @brief Increments the counter
+ * @param metric Counter
+ */
+static inline void metrics_inc(enum chuid_metric_t metric)
+{
+	if (UNEXPECTED(NULL != metrics_counters)) {
+		__atomic_fetch_add(&metrics_counters[metric], 1, __ATOMIC_RELAXED);
+	}
+}
+
+#endif /* PHPCHUID_METRICS_H_ */
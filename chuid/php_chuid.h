@@ -105,18 +105,39 @@
 #	define PHPCHUID_DEBUG(format, ...)
 #endif
 
+/**
+ * @def PHPCHUID_THREAD_CREDENTIALS
+ * @brief Defined when per-thread credentials (@c chuid.thread_credentials) are supported: ZTS builds on Linux
+ * @headerfile php_chuid.h
+ */
+#if defined(ZTS) && defined(__linux__)
+#	define PHPCHUID_THREAD_CREDENTIALS 1
+#endif
+
+/**
+ * @def PHPCHUID_HAVE_FSUID
+ * @brief Defined when @c chuid.mode=fsuid is available: @c setfsuid() and @c setfsgid() (Linux) and a capabilities library
+ * to lower @c CAP_SETUID while the request runs
+ * @headerfile php_chuid.h
+ */
+#if defined(__linux__) && (defined(WITH_CAP_LIBRARY) || defined(WITH_CAPNG_LIBRARY))
+#	define PHPCHUID_HAVE_FSUID 1
+#endif
+
 PHPCHUID_VISIBILITY_HIDDEN extern int sapi_is_cli;
 PHPCHUID_VISIBILITY_HIDDEN extern int sapi_is_cgi;
+PHPCHUID_VISIBILITY_HIDDEN extern int sapi_has_user_ini;
+PHPCHUID_VISIBILITY_HIDDEN extern int sapi_is_fpm;
 #ifdef ZTS
 PHPCHUID_VISIBILITY_HIDDEN extern int sapi_is_supported;
 #endif
+#ifdef PHPCHUID_THREAD_CREDENTIALS
+PHPCHUID_VISIBILITY_HIDDEN extern int use_thread_credentials;
+#endif
 PHPCHUID_VISIBILITY_HIDDEN extern zend_module_entry chuid_module_entry;
-PHPCHUID_VISIBILITY_HIDDEN extern HashTable blacklisted_functions;
 PHPCHUID_VISIBILITY_HIDDEN extern uid_t uid_nobody;
 PHPCHUID_VISIBILITY_HIDDEN extern gid_t gid_nogroup;
 
-PHPCHUID_VISIBILITY_HIDDEN extern void (*old_execute_internal)(zend_execute_data*, zval*);
-
 /**
  * This one is required by php/main/internal_functions.c when chuid is built statically
  *
@@ -154,33 +175,115 @@ enum change_xid_mode_t {
 	cxm_setuid,    /**< Use @c setuid() */
 	cxm_setresuid, /**< Use @c setresuid() */
 	cxm_setxid,    /**< Use @c setuid() and @c setgid() */
-	cxm_setresxid  /**< use @c setresuid() and @c setresgid() */
+	cxm_setresxid, /**< use @c setresuid() and @c setresgid() */
+	cxm_setfsuid,  /**< Use @c setfsuid() */
+	cxm_setfsxid   /**< Use @c setfsuid() and @c setfsgid() */
+};
+
+/**
+ * @brief Phases of the request timed when @c chuid.collect_stats is on
+ */
+enum chuid_phase_t {
+	cph_activate,   /**< Whole @c chuid_zend_activate() */
+	cph_docroot,    /**< @c get_docroot_guids() */
+	cph_stat,       /**< @c stat() of the @c DOCUMENT_ROOT */
+	cph_chroot_to,  /**< Computing @c chuid.chroot_to of the request */
+	cph_chroot,     /**< Entering the per-request @c chroot */
+	cph_setgroups,  /**< @c setgroups() */
+	cph_setgid,     /**< Changing GIDs */
+	cph_setuid,     /**< Changing UIDs */
+	cph_rewrite,    /**< Adjusting @c $_SERVER / @c $_ENV for the per-request @c chroot */
+	cph_deactivate, /**< Whole @c deactivate() */
+	cph_max         /**< Number of phases */
 };
 
+/**
+ * @brief Number of latency histogram buckets; the upper bound of bucket @c i is <code>2^i</code> µs, the last bucket is unbounded
+ */
+#define CHUID_STATS_BUCKETS 16
+
+/**
+ * @brief Latency statistics of a phase
+ */
+typedef struct _chuid_phase_stats {
+	uint64_t count;                        /**< Number of samples */
+	uint64_t total_ns;                     /**< Sum of the samples, ns */
+	uint64_t max_ns;                       /**< Largest sample, ns */
+	uint64_t buckets[CHUID_STATS_BUCKETS]; /**< Latency histogram */
+} chuid_phase_stats;
+
 /**
  * @headerfile php_chuid.h
  * @brief Module Globals
  */
 ZEND_BEGIN_MODULE_GLOBALS(chuid)
-	long int default_uid;          /**< Default UID */
-	long int default_gid;          /**< Default GID */
-	char* global_chroot;           /**< Global chroot() directory */
-	char* req_chroot;              /**< Per-request @c chroot */
-	int root_fd;                   /**< Root directory descriptor */
-	uid_t ruid;                    /**< Saved Real User ID */
-	uid_t euid;                    /**< Saved Effective User ID */
-	gid_t rgid;                    /**< Saved Real Group ID */
-	gid_t egid;                    /**< Saved Effective Group ID */
-	zend_bool enabled;             /**< Whether to enable this extension */
-	zend_bool disable_setuid;      /**< Whether to disable posix_set{e,}{u,g}id() functions */
-	zend_bool active;              /**< Internal flag */
-	zend_bool never_root;          /**< Never run the request as root */
-	zend_bool cli_disable;         /**< Do not change UIDs/GIDs when SAPI is CLI */
-	zend_bool no_set_gid;          /**< Do not set GID */
-	zend_bool per_req_chroot;      /**< Whether per-request @c chroot() is enabled */
-	zend_bool chrooted;            /**< Whether we need to adjust @c SCRIPT_FILENAME and @c DOCUMENT_ROOT */
-	zend_bool run_sapi_deactivate; /**< Whether to run SAPI deactivate function after calling SAPI activate to get per-directory settings */
-	enum change_xid_mode_t mode;   /**< Change UID/GID mode */
+	long int default_uid;               /**< Default UID */
+	long int default_gid;               /**< Default GID */
+	char* global_chroot;                /**< Global chroot() directory */
+	char* req_chroot;                   /**< Per-request @c chroot */
+	char* rewrite_vars;                 /**< Server variables to adjust for the per-request @c chroot */
+	zend_string* jail;                  /**< Per-request @c chroot of the current request, without the trailing slash */
+	int root_fd;                        /**< Root directory descriptor */
+	uid_t ruid;                         /**< Saved Real User ID */
+	uid_t euid;                         /**< Saved Effective User ID */
+	gid_t rgid;                         /**< Saved Real Group ID */
+	gid_t egid;                         /**< Saved Effective Group ID */
+	zend_bool enabled;                  /**< Whether to enable this extension */
+	zend_bool disable_setuid;           /**< Whether to disable posix_set{e,}{u,g}id() functions */
+	zend_bool active;                   /**< Internal flag */
+	zend_bool never_root;               /**< Never run the request as root */
+	zend_bool cli_disable;              /**< Do not change UIDs/GIDs when SAPI is CLI */
+	zend_bool no_set_gid;               /**< Do not set GID */
+	zend_bool per_req_chroot;           /**< Whether per-request @c chroot() is enabled */
+	zend_bool chrooted;                 /**< Whether we need to adjust @c SCRIPT_FILENAME and @c DOCUMENT_ROOT */
+	zend_bool run_sapi_deactivate;      /**< Whether to run SAPI deactivate function after calling SAPI activate to get per-directory settings */
+	zend_bool stay_in_jail;             /**< Whether to stay in the per-request @c chroot until a request needs another one */
+	zend_bool in_jail;                  /**< Whether the previous request has left the process in its per-request @c chroot */
+	zend_bool defer_restore;            /**< Whether to keep the credentials of the request until the next request needs different ones */
+	zend_bool switched;                 /**< Whether the process runs with the credentials set by @c set_guids() */
+	uid_t cur_uid;                      /**< UID set by @c set_guids() */
+	gid_t cur_gid;                      /**< GID set by @c set_guids() */
+	enum change_xid_mode_t mode;        /**< Change UID/GID mode */
+	char* mode_name;                    /**< @c chuid.mode: @c default or @c fsuid */
+	char* docroot_base;                 /**< Common parent directory of the document roots, resolved once */
+	zend_bool docroot_statx;            /**< Whether to get the owner of the @c DOCUMENT_ROOT with <code>statx(AT_STATX_DONT_SYNC)</code> */
+	long int docroot_cache_ttl;         /**< Lifetime of the DOCUMENT_ROOT cache entries, in seconds; 0 disables the cache */
+	long int shm_cache_slots;           /**< Number of slots in the DOCUMENT_ROOT cache shared between the workers; 0 disables the shared cache */
+	long int docroot_cache_size;        /**< Maximum number of entries in the DOCUMENT_ROOT cache */
+	long int chroot_cache_size;         /**< Maximum number of entries in the per-directory @c chuid.chroot_to cache */
+	long int jail_fd_cache_size;        /**< Maximum number of cached descriptors of the per-request @c chroot directories; 0 disables the cache */
+	long int jail_fd_cache_ttl;         /**< How often to check that the path of a cached jail leads to the same directory, in seconds */
+	char* prewarm_list;                 /**< File with the document roots to cache in MINIT */
+	HashTable jail_fds;                 /**< Per-request @c chroot directory → descriptor cache */
+	HashTable chroot_cache;             /**< Per-directory @c chuid.chroot_to cache */
+	HashTable docroot_cache;            /**< DOCUMENT_ROOT → owner UID/GID cache */
+	zend_ulong docroot_cache_hits;      /**< Number of DOCUMENT_ROOT cache hits */
+	zend_ulong docroot_cache_shm_hits;  /**< Number of hits in the DOCUMENT_ROOT cache shared between the workers */
+	zend_ulong docroot_cache_misses;    /**< Number of DOCUMENT_ROOT cache misses */
+	zend_ulong docroot_cache_evictions; /**< Number of entries evicted from the full DOCUMENT_ROOT cache */
+	zend_bool supplementary_groups;     /**< Whether to set the supplementary groups of the user */
+	long int groups_refresh_interval;   /**< How often to rebuild the supplementary groups index, in seconds; 0 disables the rebuilding */
+	char* vhost_file;                   /**< Host name → identity table */
+	char* vhost_variable;               /**< Server variable with the host name of the request */
+	char* map_file;                     /**< Precompiled path prefix → identity map */
+	zend_bool map_use_script_filename;  /**< Whether to look up @c SCRIPT_FILENAME instead of @c DOCUMENT_ROOT in @c map_file */
+	const char* map_chroot;             /**< Per-request @c chroot of the request from @c map_file, @c NULL if none */
+	size_t map_chroot_len;              /**< Length of @c map_chroot */
+	char* metrics_file;                 /**< Where to write the metrics shared between the workers */
+	long int metrics_interval;          /**< How often to write @c metrics_file, in seconds */
+	long int metrics_slots;             /**< Number of per-worker slots in the shared metrics segment; 0 disables the metrics */
+	long int warning_interval;          /**< Report the same DOCUMENT_ROOT error at most once per this many seconds; 0 disables rate limiting */
+	HashTable warnings;                 /**< Recently reported DOCUMENT_ROOT errors */
+	zend_ulong warnings_suppressed;     /**< Number of warnings suppressed because of @c warning_interval */
+	time_t warnings_next_flush;         /**< When the first suppressed warnings are due to be reported; 0 if there are none */
+	zend_bool collect_stats;            /**< Whether to time the phases of the request */
+	chuid_phase_stats stats[cph_max];   /**< Per-phase latency statistics */
+	long int realpath_partitions_size;  /**< Maximum size of the parked realpath cache partitions, in bytes; 0 disables the partitioning */
+	HashTable rpcache;                  /**< Parked realpath cache partitions */
+	zend_string* rpcache_key;           /**< Key of the partition in the engine's realpath cache */
+	zend_long rpcache_parked;           /**< Size of the parked partitions (the entries and the bucket arrays), in bytes */
+	zend_bool thread_credentials;       /**< Whether to change the credentials of the calling thread only (ZTS) */
+	zend_bool thread_ready;             /**< Whether the thread has copied the state computed in MINIT */
 ZEND_END_MODULE_GLOBALS(chuid)
 
 PHPCHUID_VISIBILITY_HIDDEN extern ZEND_DECLARE_MODULE_GLOBALS(chuid);
@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Startup cache prewarming — implementation
+ *
+ * Every document root of the list goes through the same lookups as the first request for it would:
+ * its owner is put into the @c DOCUMENT_ROOT cache (and the shared cache), the value of @c chuid.chroot_to
+ * for the scripts in the document root into the per-directory cache, and the descriptor of the jail into the jail
+ * descriptor cache. The caches are the ordinary per-process ones: the workers forked by the SAPI inherit them,
+ * and the entries expire just like those added by the requests.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include "prewarm.h"
+#include "chroot.h"
+#include "helpers.h"
+#include "mapfile.h"
+
+/**
+ * @brief Maximum length of a host name
+ */
+#define PREWARM_HOST_MAX 255
+
+/**
+ * @brief Splits off the next whitespace-separated field of the line
+ * @param p [in,out] Current position; moved past the field
+ * @return The field (NUL-terminated in place), @c NULL if there are no more fields
+ */
+static char* next_field(char** p)
+{
+	char* s = *p;
+	char* field;
+
+	while (isspace((unsigned char)*s)) {
+		++s;
+	}
+
+	if (!*s || '#' == *s) {
+		*p = s;
+		return NULL;
+	}
+
+	field = s;
+	while (*s && !isspace((unsigned char)*s)) {
+		++s;
+	}
+
+	if (*s) {
+		*s++ = 0;
+	}
+
+	*p = s;
+	return field;
+}
+
+/**
+ * @brief Prewarms the caches for one document root
+ * @param docroot Document root
+ * @param host Host name, @c NULL if not given
+ */
+static void prewarm_docroot(const char* docroot, const char* host)
+{
+	size_t len       = strlen(docroot);
+	const char* root = NULL;
+	size_t root_len  = 0;
+	uid_t uid;
+	gid_t gid;
+
+	/* Requests whose document root is in the map take their identity and root from it and never consult the caches */
+	if (CHUID_G(map_use_script_filename) || !map_file_loaded() || FAILURE == map_file_lookup(docroot, len, &uid, &gid, &root, &root_len)) {
+		prewarm_docroot_guids(docroot, len);
+
+		if (CHUID_G(per_req_chroot)) {
+			if (sapi_has_user_ini) {
+				zend_string* r = prewarm_req_chroot(host, docroot);
+
+				root     = r ? ZSTR_VAL(r) : NULL;
+				root_len = r ? ZSTR_LEN(r) : 0;
+			}
+			else if (CHUID_G(req_chroot)) {
+				/* Per-directory settings are only known to the SAPI; the system value is the best guess */
+				root     = CHUID_G(req_chroot);
+				root_len = strlen(root);
+			}
+		}
+	}
+
+	if (CHUID_G(per_req_chroot) && root && '/' == *root) {
+		prewarm_jail(root, root_len);
+	}
+}
+
+int prewarm_load(const char* path)
+{
+	char line[MAXPATHLEN + PREWARM_HOST_MAX + 16];
+	unsigned int n = 0;
+	FILE* f        = fopen(path, "r");
+
+	if (!f) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "fopen(%s): %s", path, strerror(errno));
+		return FAILURE;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char* p = line;
+		char* docroot;
+		char* host;
+
+		++n;
+		docroot = next_field(&p);
+		if (!docroot) {
+			continue;
+		}
+
+		host = next_field(&p);
+		if ('/' != *docroot || (host && (strlen(host) > PREWARM_HOST_MAX || next_field(&p)))) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "%s:%u: expected \"docroot [host]\"", path, n);
+			continue;
+		}
+
+		prewarm_docroot(docroot, host);
+	}
+
+	fclose(f);
+	return SUCCESS;
+}
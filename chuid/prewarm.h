@@ -0,0 +1,24 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Startup cache prewarming — definitions
+ */
+
+#ifndef PHPCHUID_PREWARM_H_
+#define PHPCHUID_PREWARM_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Fills the caches of the process with the document roots listed in the file
+ * @param path Path to the file with <code>docroot [host]</code> lines
+ * @return Whether the file has been read
+ * @retval SUCCESS Yes (invalid lines are reported and skipped)
+ * @retval FAILURE No (the file cannot be read)
+ * @note Called in MINIT, after the global @c chroot and before the capabilities are dropped,
+ * so that the forked workers start with the caches filled
+ */
+PHPCHUID_VISIBILITY_HIDDEN int prewarm_load(const char* path);
+
+#endif /* PHPCHUID_PREWARM_H_ */
@@ -0,0 +1,40 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief USDT probes
+ *
+ * When the extension is configured with @c --enable-chuid-probes, the probes are compiled in as SystemTap SDT notes
+ * (provider @c chuid) which can be attached to with @c bpftrace, @c perf or @c stap. A probe which is not being traced
+ * is a single @c nop. Without the option the macros only evaluate their arguments, which the compiler drops.
+ *
+ * <TABLE>
+ * <TR><TH>Probe</TH><TH>Arguments</TH></TR>
+ * <TR><TD>@c activate__start</TD><TD>none</TD></TR>
+ * <TR><TD>@c activate__done</TD><TD>UID, GID, whether the request has been chrooted</TD></TR>
+ * <TR><TD>@c docroot</TD><TD>DOCUMENT_ROOT (may be @c NULL), UID, GID, @c errno of @c stat() (-1 if there is no DOCUMENT_ROOT), whether the result came from the cache</TD></TR>
+ * <TR><TD>@c set__guids</TD><TD>UID, GID, mode (@c change_xid_mode_t), result (0 on success)</TD></TR>
+ * <TR><TD>@c chroot</TD><TD>new root, result (0 on success)</TD></TR>
+ * <TR><TD>@c deactivate</TD><TD>result of restoring UID/GID, result of escaping the per-request @c chroot (0 on success)</TD></TR>
+ * </TABLE>
+ */
+
+#ifndef PHPCHUID_PROBES_H_
+#define PHPCHUID_PROBES_H_
+
+#ifdef HAVE_CHUID_PROBES
+#	include <sys/sdt.h>
+#	define CHUID_PROBE0(name)                     DTRACE_PROBE(chuid, name)
+#	define CHUID_PROBE2(name, a1, a2)             DTRACE_PROBE2(chuid, name, a1, a2)
+#	define CHUID_PROBE3(name, a1, a2, a3)         DTRACE_PROBE3(chuid, name, a1, a2, a3)
+#	define CHUID_PROBE4(name, a1, a2, a3, a4)     DTRACE_PROBE4(chuid, name, a1, a2, a3, a4)
+#	define CHUID_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(chuid, name, a1, a2, a3, a4, a5)
+#else
+#	define CHUID_PROBE0(name)                     do { } while (0)
+#	define CHUID_PROBE2(name, a1, a2)             do { (void)(a1); (void)(a2); } while (0)
+#	define CHUID_PROBE3(name, a1, a2, a3)         do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#	define CHUID_PROBE4(name, a1, a2, a3, a4)     do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+#	define CHUID_PROBE5(name, a1, a2, a3, a4, a5) do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); } while (0)
+#endif
+
+#endif /* PHPCHUID_PROBES_H_ */
@@ -0,0 +1,185 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Rate-limited warnings — implementation
+ */
+
+#include <time.h>
+#include "ratelimit.h"
+#include "cache.h"
+#include "metrics.h"
+
+/**
+ * @brief Maximum number of errors to track; when the table is full, the oldest entry is evicted
+ */
+#define RATELIMIT_MAX_ENTRIES 1024
+
+/**
+ * @brief Tracked error
+ */
+typedef struct _ratelimit_entry {
+	time_t until;          /**< End of the current interval */
+	zend_ulong suppressed; /**< Number of the warnings suppressed in the current interval */
+	int error;             /**< @c errno of the failed @c stat(), 0 if there is no DOCUMENT_ROOT */
+} ratelimit_entry;
+
+/**
+ * @brief Entry destructor
+ * @param zv Entry to destroy
+ */
+static void ratelimit_dtor(zval* zv)
+{
+	pefree(Z_PTR_P(zv), 1);
+}
+
+void ratelimit_init(HashTable* ht)
+{
+	zend_hash_init(ht, 8, NULL, ratelimit_dtor, 1);
+}
+
+void ratelimit_destroy(HashTable* ht)
+{
+	zend_hash_destroy(ht);
+}
+
+/**
+ * @brief Formats the summary of the suppressed warnings
+ * @param key Error key
+ * @param len Length of @c key
+ * @param entry Entry
+ * @return Message; must be freed with @c efree()
+ */
+static char* format_summary(const char* key, size_t len, const ratelimit_entry* entry)
+{
+	char* msg;
+
+	if (!len) {
+		spprintf(&msg, 0, "Cannot get DOCUMENT_ROOT: failed " ZEND_ULONG_FMT " more times in the last %lds", entry->suppressed, CHUID_G(warning_interval));
+	}
+	else {
+		const char* docroot = (const char*)memchr(key, ':', len) + 1;
+
+		spprintf(&msg, 0, "stat(%.*s) failed " ZEND_ULONG_FMT " more times in the last %lds: %s", (int)(len - (size_t)(docroot - key)), docroot, entry->suppressed, CHUID_G(warning_interval), strerror(entry->error));
+	}
+
+	return msg;
+}
+
+/**
+ * @brief Decides whether the warning should be emitted
+ * @param key Error key
+ * @param len Length of @c key
+ * @param error @c errno of the failed @c stat()
+ * @return Whether to emit the warning
+ *
+ * If the warnings suppressed in the previous interval have not been reported by @c ratelimit_flush() yet,
+ * they are reported before the new warning.
+ */
+static int ratelimit_allow(const char* key, size_t len, int error)
+{
+	HashTable* ht   = &CHUID_G(warnings);
+	time_t now      = time(NULL);
+	ratelimit_entry* entry;
+
+	entry = zend_hash_str_find_ptr(ht, key, len);
+	if (entry) {
+		if (now < entry->until) {
+			++entry->suppressed;
+			++CHUID_G(warnings_suppressed);
+			metrics_inc(cmt_warnings_suppressed);
+			if (!CHUID_G(warnings_next_flush) || entry->until < CHUID_G(warnings_next_flush)) {
+				CHUID_G(warnings_next_flush) = entry->until;
+			}
+
+			return 0;
+		}
+
+		if (entry->suppressed) {
+			char* msg = format_summary(key, len, entry);
+
+			PHPCHUID_ERROR(E_WARNING, "%s", msg);
+			efree(msg);
+		}
+
+		entry->suppressed = 0;
+		entry->until      = now + CHUID_G(warning_interval);
+		return 1;
+	}
+	else {
+		ratelimit_entry e;
+
+		e.until      = now + CHUID_G(warning_interval);
+		e.suppressed = 0;
+		e.error      = error;
+		cache_make_room(ht, RATELIMIT_MAX_ENTRIES);
+		zend_hash_str_update_mem(ht, key, len, &e, sizeof(e));
+		return 1;
+	}
+}
+
+/**
+ * The summaries go straight to the error log: the request (if any) has finished.
+ */
+int ratelimit_flush_due(void)
+{
+	return CHUID_G(warnings_next_flush) && time(NULL) >= CHUID_G(warnings_next_flush);
+}
+
+void ratelimit_flush(int force)
+{
+	zend_string* key;
+	ratelimit_entry* entry;
+	time_t now  = time(NULL);
+	time_t next = 0;
+
+	if (!force && (!CHUID_G(warnings_next_flush) || now < CHUID_G(warnings_next_flush))) {
+		return;
+	}
+
+	ZEND_HASH_FOREACH_STR_KEY_PTR(&CHUID_G(warnings), key, entry) {
+		if (entry->suppressed && (force || now >= entry->until)) {
+			char* msg = format_summary(ZSTR_VAL(key), ZSTR_LEN(key), entry);
+			char* line;
+
+			spprintf(&line, 0, "PHP Warning:  %s", msg);
+			php_log_err(line);
+			efree(line);
+			efree(msg);
+			entry->suppressed = 0;
+		}
+		else if (entry->suppressed && (!next || entry->until < next)) {
+			next = entry->until;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	CHUID_G(warnings_next_flush) = next;
+}
+
+/**
+ * The key of the "no DOCUMENT_ROOT" error is an empty string; the key of a @c stat() failure is
+ * <code>errno:DOCUMENT_ROOT</code>, so that different failures of the same document root are reported separately.
+ */
+void report_docroot_error(const char* docroot, size_t len, int error)
+{
+	if (CHUID_G(warning_interval) > 0) {
+		char key[MAXPATHLEN + 16];
+		size_t key_len = 0;
+
+		if (docroot) {
+			int n   = snprintf(key, sizeof(key), "%d:%.*s", error, (int)len, docroot);
+			key_len = MIN((size_t)n, sizeof(key) - 1);
+		}
+
+		if (!ratelimit_allow(key, key_len, error)) {
+			return;
+		}
+	}
+
+	if (NULL == docroot) {
+		PHPCHUID_ERROR(E_WARNING, "%s", "Cannot get DOCUMENT_ROOT");
+	}
+	else {
+		PHPCHUID_ERROR(E_WARNING, "stat(%s): %s", docroot, strerror(error));
+	}
+}
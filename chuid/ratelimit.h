@@ -0,0 +1,50 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Rate-limited warnings — definitions
+ */
+
+#ifndef PHPCHUID_RATELIMIT_H_
+#define PHPCHUID_RATELIMIT_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Initializes the table of the recently reported errors
+ * @param ht Hash table to initialize
+ */
+PHPCHUID_VISIBILITY_HIDDEN void ratelimit_init(HashTable* ht);
+
+/**
+ * @brief Destroys the table of the recently reported errors
+ * @param ht Hash table to destroy
+ */
+PHPCHUID_VISIBILITY_HIDDEN void ratelimit_destroy(HashTable* ht);
+
+/**
+ * @brief Reports a failure to get the owner of the @c DOCUMENT_ROOT
+ * @param docroot Document root, @c NULL if the SAPI has not provided it
+ * @param len Length of @c docroot
+ * @param error @c errno of the failed @c stat() (ignored if @c docroot is @c NULL)
+ *
+ * If @c chuid.warning_interval is positive, the same error for the same @c DOCUMENT_ROOT is reported once per interval;
+ * the number of the suppressed warnings is reported by @c ratelimit_flush() once the interval has expired,
+ * or before the next warning, whichever comes first.
+ */
+PHPCHUID_VISIBILITY_HIDDEN void report_docroot_error(const char* docroot, size_t len, int error);
+
+/**
+ * @brief Writes the number of the suppressed warnings to the error log for the errors whose interval has expired
+ * @param force Whether to report all suppressed warnings, even if their interval has not expired (at shutdown)
+ * @note Cheap when there is nothing to report; must run with the original credentials, outside of any per-request @c chroot
+ */
+PHPCHUID_VISIBILITY_HIDDEN void ratelimit_flush(int force);
+
+/**
+ * @brief Checks whether @c ratelimit_flush() has something to report
+ * @return Whether the interval of a suppressed warning has expired
+ */
+PHPCHUID_VISIBILITY_HIDDEN int ratelimit_flush_due(void);
+
+#endif /* PHPCHUID_RATELIMIT_H_ */
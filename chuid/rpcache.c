@@ -0,0 +1,154 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Realpath cache partitioned by identity and jail — implementation
+ *
+ * The engine keeps the realpath cache in a fixed array of bucket chains in @c virtual_cwd_globals.
+ * A partition is a copy of that array (the chains themselves are not copied) and the size of its entries.
+ */
+
+#include <Zend/zend_virtual_cwd.h>
+#include "rpcache.h"
+
+/**
+ * @brief Parked partition
+ */
+typedef struct _rpcache_partition {
+	zend_long size;                    /**< Size of the entries, as accounted by the engine */
+	realpath_cache_bucket* buckets[];  /**< Bucket chains, @c realpath_cache_max_buckets() elements */
+} rpcache_partition;
+
+/**
+ * @brief Memory taken by a parked partition: its entries and its copy of the bucket array
+ * @param p Partition
+ * @return Size in bytes
+ */
+static zend_long partition_cost(const rpcache_partition* p)
+{
+	return p->size + (zend_long)(sizeof(rpcache_partition) + (size_t)realpath_cache_max_buckets() * sizeof(realpath_cache_bucket*));
+}
+
+/**
+ * @brief Frees the entries of a partition and the partition
+ * @param p Partition
+ * @note The engine allocates the buckets with @c malloc() and frees them with @c free() (see @c realpath_cache_clean())
+ */
+static void partition_free(rpcache_partition* p)
+{
+	int n = realpath_cache_max_buckets();
+	int i;
+
+	for (i=0; i<n; ++i) {
+		realpath_cache_bucket* r = p->buckets[i];
+
+		while (r) {
+			realpath_cache_bucket* next = r->next;
+
+			free(r);
+			r = next;
+		}
+	}
+
+	pefree(p, 1);
+}
+
+/**
+ * @brief Frees the least recently used partitions until the parked entries fit into @c chuid.realpath_partitions_size
+ *
+ * A partition is removed from the table when it is restored and added back when it is parked again,
+ * so the order of the table is the order of use, and the least recently used partition is the first one.
+ */
+static void evict(void)
+{
+	HashTable* ht = &CHUID_G(rpcache);
+
+	while (CHUID_G(rpcache_parked) > CHUID_G(realpath_partitions_size) && zend_hash_num_elements(ht)) {
+		HashPosition pos;
+		zend_string* key;
+		zend_ulong idx;
+		rpcache_partition* p;
+
+		zend_hash_internal_pointer_reset_ex(ht, &pos);
+		p = zend_hash_get_current_data_ptr_ex(ht, &pos);
+		zend_hash_get_current_key_ex(ht, &key, &idx, &pos);
+
+		CHUID_G(rpcache_parked) -= partition_cost(p);
+		zend_hash_del(ht, key);
+		partition_free(p);
+	}
+}
+
+void rpcache_init(HashTable* ht)
+{
+	zend_hash_init(ht, 8, NULL, NULL, 1);
+}
+
+void rpcache_destroy(HashTable* ht)
+{
+	rpcache_partition* p;
+
+	ZEND_HASH_FOREACH_PTR(ht, p) {
+		partition_free(p);
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(ht);
+}
+
+/**
+ * The partition is keyed by <code>uid:jail</code>. The entries of the engine's cache are moved into a new partition
+ * and the partition of the request, if any, is moved back, so a switch costs two copies of the bucket array
+ * regardless of the number of entries.
+ */
+void rpcache_switch(uid_t uid, const zend_string* jail)
+{
+	char key[MAXPATHLEN + 32];
+	size_t len;
+	zend_string* current       = CHUID_G(rpcache_key);
+	realpath_cache_bucket** rc = realpath_cache_get_buckets();
+	size_t bytes               = (size_t)realpath_cache_max_buckets() * sizeof(realpath_cache_bucket*);
+	rpcache_partition* p;
+
+	if (CHUID_G(realpath_partitions_size) <= 0) {
+		return;
+	}
+
+	len = (size_t)snprintf(key, sizeof(key), "%lu:%s", (unsigned long int)uid, jail ? ZSTR_VAL(jail) : "");
+	if (len >= sizeof(key)) {
+		return;
+	}
+
+	if (current && ZSTR_LEN(current) == len && !memcmp(ZSTR_VAL(current), key, len)) {
+		return;
+	}
+
+	if (current) {
+		if (CWDG(realpath_cache_size) > 0) {
+			p       = pemalloc(sizeof(rpcache_partition) + bytes, 1);
+			p->size = CWDG(realpath_cache_size);
+			memcpy(p->buckets, rc, bytes);
+			zend_hash_update_ptr(&CHUID_G(rpcache), current, p);
+			CHUID_G(rpcache_parked) += partition_cost(p);
+		}
+
+		zend_string_release(current);
+		memset(rc, 0, bytes);
+		CWDG(realpath_cache_size) = 0;
+	}
+	else {
+		/* Nobody knows whose the entries resolved before the first request are */
+		realpath_cache_clean();
+	}
+
+	p = zend_hash_str_find_ptr(&CHUID_G(rpcache), key, len);
+	if (p) {
+		memcpy(rc, p->buckets, bytes);
+		CWDG(realpath_cache_size) = p->size;
+		CHUID_G(rpcache_parked)  -= partition_cost(p);
+		zend_hash_str_del(&CHUID_G(rpcache), key, len);
+		pefree(p, 1);
+	}
+
+	CHUID_G(rpcache_key) = zend_string_init(key, len, 1);
+	evict();
+}
@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Realpath cache partitioned by identity and jail — definitions
+ *
+ * The realpath cache of the engine belongs to the process, but its entries are only valid for the user and the root
+ * directory they were resolved with. Instead of flushing the cache when a request of another user or jail comes,
+ * the entries are parked in a partition of their own and put back when that user and jail come again.
+ */
+
+#ifndef PHPCHUID_RPCACHE_H_
+#define PHPCHUID_RPCACHE_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Initializes the table of the parked partitions
+ * @param ht Hash table to initialize
+ */
+PHPCHUID_VISIBILITY_HIDDEN void rpcache_init(HashTable* ht);
+
+/**
+ * @brief Frees the parked partitions
+ * @param ht Hash table to destroy
+ */
+PHPCHUID_VISIBILITY_HIDDEN void rpcache_destroy(HashTable* ht);
+
+/**
+ * @brief Makes the partition of @c uid and @c jail the realpath cache of the engine
+ * @param uid UID of the request
+ * @param jail Per-request root of the request, @c NULL if the request is not chrooted
+ *
+ * Does nothing if @c chuid.realpath_partitions_size is 0 or the partition is already the current one.
+ * When the parked partitions take more than @c chuid.realpath_partitions_size bytes, the least recently used ones are freed.
+ */
+PHPCHUID_VISIBILITY_HIDDEN void rpcache_switch(uid_t uid, const zend_string* jail);
+
+#endif /* PHPCHUID_RPCACHE_H_ */
@@ -0,0 +1,273 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief DOCUMENT_ROOT owner cache shared between worker processes — implementation
+ *
+ * The cache is an open addressing hash table in an anonymous shared mapping created before the SAPI forks.
+ * Every slot is protected by a sequence lock: writers make the sequence odd with a compare-and-swap, update the slot
+ * and make the sequence even again; readers never write to the shared memory and retry (or give up) if the sequence
+ * has changed while they were copying the slot. The lock word also holds the PID of the writer, so that a slot left
+ * locked by a killed worker can be taken over.
+ *
+ * The mapping is read-only except while an entry is being stored, which only happens with full privileges;
+ * the entries are checked for sanity before use anyway.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "shmcache.h"
+
+/**
+ * @brief Maximum length of the cached path, including the terminating NUL
+ */
+#define SHM_CACHE_PATH_MAX 256
+
+/**
+ * @brief How many slots to probe before giving up
+ */
+#define SHM_CACHE_PROBES   8
+
+/**
+ * @brief How many times a reader retries a slot that is being modified
+ */
+#define SHM_CACHE_RETRIES  4
+
+/**
+ * @brief Shared cache slot
+ */
+typedef struct _shm_cache_slot {
+	uint64_t lock;                  /**< Sequence (low 32 bits, odd while the slot is being updated) and the PID of the writer (high 32 bits) */
+	uint32_t hash;                  /**< Hash of @c path */
+	time_t expires;                 /**< When the entry expires; 0 if the slot is empty */
+	uid_t uid;                      /**< Owner UID */
+	gid_t gid;                      /**< Owner GID */
+	int error;                      /**< @c errno of the failed @c stat() */
+	uint32_t len;                   /**< Length of @c path */
+	char path[SHM_CACHE_PATH_MAX];  /**< DOCUMENT_ROOT */
+} shm_cache_slot;
+
+/**
+ * @brief Shared slots
+ */
+static shm_cache_slot* shm_slots = NULL;
+
+/**
+ * @brief Number of elements in @c shm_slots
+ */
+static size_t shm_nslots = 0;
+
+/**
+ * @brief Makes the shared slots writable or read-only
+ * @param writable Whether the slots should be writable
+ * @return Whether the call succeeded
+ * @retval SUCCESS Yes
+ * @retval FAILURE No
+ */
+static int shm_cache_protect(int writable)
+{
+	return 0 == mprotect(shm_slots, shm_nslots * sizeof(shm_cache_slot), writable ? PROT_READ | PROT_WRITE : PROT_READ) ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Checks whether the process which has locked the slot has died
+ * @param lock Value of the lock word (odd sequence)
+ * @return Whether the writer is gone
+ */
+static int writer_is_dead(uint64_t lock)
+{
+	pid_t pid = (pid_t)(lock >> 32);
+	return pid > 0 && -1 == kill(pid, 0) && ESRCH == errno;
+}
+
+/**
+ * @brief Checks whether the cached entry makes sense
+ * @param slot Copy of the slot
+ * @param now Current time
+ * @return Whether the entry can be used
+ */
+static int slot_is_sane(const shm_cache_slot* slot, time_t now)
+{
+	if (slot->error) {
+		return slot->error > 0;
+	}
+
+	return
+		   slot->uid != (uid_t)-1
+		&& slot->gid != (gid_t)-1
+		&& slot->expires <= now + CHUID_G(docroot_cache_ttl)
+	;
+}
+
+int shm_cache_init(size_t slots)
+{
+	void* p;
+
+	assert(NULL == shm_slots);
+
+	p = mmap(NULL, slots * sizeof(shm_cache_slot), PROT_READ, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p) {
+		return FAILURE;
+	}
+
+	shm_slots  = (shm_cache_slot*)p;
+	shm_nslots = slots;
+	return SUCCESS;
+}
+
+void shm_cache_destroy(void)
+{
+	if (shm_slots) {
+		munmap(shm_slots, shm_nslots * sizeof(shm_cache_slot));
+		shm_slots  = NULL;
+		shm_nslots = 0;
+	}
+}
+
+/**
+ * @brief Copies the slot consistently
+ * @param slot Slot to read
+ * @param copy [out] Copy of the slot
+ * @param docroot Document root; the path is copied only if the hash and the length match
+ * @param len Length of @c docroot
+ * @param hash Hash of @c docroot
+ * @return Whether the slot holds @c docroot
+ * @retval 1 Yes
+ * @retval 0 No (or the slot could not be read consistently)
+ */
+static int read_slot(const shm_cache_slot* slot, shm_cache_slot* copy, const char* docroot, uint32_t len, uint32_t hash)
+{
+	int i;
+
+	copy->expires = 0;
+	for (i=0; i<SHM_CACHE_RETRIES; ++i) {
+		int found;
+		uint64_t lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+
+		if (lock & 1) {
+			continue;
+		}
+
+		copy->hash    = slot->hash;
+		copy->len     = slot->len;
+		copy->expires = slot->expires;
+		copy->uid     = slot->uid;
+		copy->gid     = slot->gid;
+		copy->error   = slot->error;
+		found         = copy->hash == hash && copy->len == len && !memcmp(slot->path, docroot, len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == lock) {
+			return found;
+		}
+	}
+
+	return 0;
+}
+
+int shm_cache_find(const char* docroot, size_t len, uid_t* uid, gid_t* gid, int* error, time_t* expires)
+{
+	size_t i;
+	uint32_t hash;
+	time_t now;
+
+	if (!shm_slots || len >= SHM_CACHE_PATH_MAX) {
+		return FAILURE;
+	}
+
+	hash = (uint32_t)zend_inline_hash_func(docroot, len);
+	now  = time(NULL);
+
+	for (i=0; i<SHM_CACHE_PROBES; ++i) {
+		shm_cache_slot copy;
+		const shm_cache_slot* slot = &shm_slots[(hash + i) % shm_nslots];
+
+		if (read_slot(slot, &copy, docroot, (uint32_t)len, hash)) {
+			if (copy.expires <= now || !slot_is_sane(&copy, now)) {
+				return FAILURE;
+			}
+
+			*uid     = copy.uid;
+			*gid     = copy.gid;
+			*error   = copy.error;
+			*expires = copy.expires;
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
+
+/**
+ * The entry goes to the slot which already holds @c docroot, or to the first empty or expired slot.
+ * If there is none, the home slot of @c docroot is overwritten. A slot locked by a process which no longer exists
+ * is taken over.
+ */
+void shm_cache_add(const char* docroot, size_t len, uid_t uid, gid_t gid, int error, time_t expires)
+{
+	size_t i;
+	uint32_t hash;
+	uint32_t seq;
+	uint64_t lock;
+	time_t now;
+	shm_cache_slot* slot = NULL;
+
+	if (!shm_slots || len >= SHM_CACHE_PATH_MAX) {
+		return;
+	}
+
+	hash = (uint32_t)zend_inline_hash_func(docroot, len);
+	now  = time(NULL);
+
+	for (i=0; i<SHM_CACHE_PROBES; ++i) {
+		shm_cache_slot copy;
+		shm_cache_slot* s = &shm_slots[(hash + i) % shm_nslots];
+
+		if (read_slot(s, &copy, docroot, (uint32_t)len, hash)) {
+			slot = s;
+			break;
+		}
+
+		if (!slot && copy.expires <= now) {
+			slot = s;
+		}
+	}
+
+	if (!slot) {
+		slot = &shm_slots[hash % shm_nslots];
+	}
+
+	lock = __atomic_load_n(&slot->lock, __ATOMIC_RELAXED);
+	if ((lock & 1) && !writer_is_dead(lock)) {
+		return;
+	}
+
+	if (FAILURE == shm_cache_protect(1)) {
+		return;
+	}
+
+	/* A slot abandoned in the middle of an update gets a new odd sequence, so that its readers notice the change */
+	seq = (uint32_t)lock + ((lock & 1) ? 2 : 1);
+	if (!__atomic_compare_exchange_n(&slot->lock, &lock, ((uint64_t)getpid() << 32) | seq, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		shm_cache_protect(0);
+		return;
+	}
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->hash    = hash;
+	slot->len     = (uint32_t)len;
+	slot->expires = expires;
+	slot->uid     = uid;
+	slot->gid     = gid;
+	slot->error   = error;
+	memcpy(slot->path, docroot, len);
+	slot->path[len] = 0;
+
+	__atomic_store_n(&slot->lock, (uint64_t)(uint32_t)(seq + 1), __ATOMIC_RELEASE);
+	shm_cache_protect(0);
+}
@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief DOCUMENT_ROOT owner cache shared between worker processes — definitions
+ */
+
+#ifndef PHPCHUID_SHMCACHE_H_
+#define PHPCHUID_SHMCACHE_H_
+
+#include <time.h>
+#include "php_chuid.h"
+
+/**
+ * @brief Creates the shared memory segment
+ * @param slots Number of slots
+ * @return Whether the call succeeded
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (@c mmap() failed, @c errno will be set)
+ * @note Must be called before the SAPI forks its children (i.e., in MINIT)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int shm_cache_init(size_t slots);
+
+/**
+ * @brief Destroys the shared memory segment
+ */
+PHPCHUID_VISIBILITY_HIDDEN void shm_cache_destroy(void);
+
+/**
+ * @brief Looks up the owner of the @c DOCUMENT_ROOT in the shared cache
+ * @param docroot Document root
+ * @param len Length of @c docroot
+ * @param uid [out] Cached UID
+ * @param gid [out] Cached GID
+ * @param error [out] Cached @c errno of the failed @c stat()
+ * @param expires [out] When the entry expires
+ * @return Whether a valid entry has been found
+ * @retval SUCCESS Yes
+ * @retval FAILURE No
+ * @note Never blocks: a slot that is being updated is treated as a miss
+ */
+PHPCHUID_VISIBILITY_HIDDEN int shm_cache_find(const char* docroot, size_t len, uid_t* uid, gid_t* gid, int* error, time_t* expires);
+
+/**
+ * @brief Stores the owner of the @c DOCUMENT_ROOT in the shared cache
+ * @param docroot Document root
+ * @param len Length of @c docroot
+ * @param uid UID
+ * @param gid GID
+ * @param error @c errno of the failed @c stat()
+ * @param expires When the entry expires
+ * @note Never blocks: if another process is updating the target slot, the entry is not stored
+ */
+PHPCHUID_VISIBILITY_HIDDEN void shm_cache_add(const char* docroot, size_t len, uid_t uid, gid_t gid, int error, time_t expires);
+
+#endif /* PHPCHUID_SHMCACHE_H_ */
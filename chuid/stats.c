@@ -0,0 +1,122 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-phase latency statistics — implementation
+ */
+
+#include <ext/standard/info.h>
+#include "stats.h"
+
+/**
+ * @brief Phase names, in the order of @c chuid_phase_t
+ */
+static const char* const phase_names[cph_max] = {
+	"activate",
+	"docroot",
+	"stat",
+	"chroot_to",
+	"chroot",
+	"setgroups",
+	"setgid",
+	"setuid",
+	"rewrite",
+	"deactivate"
+};
+
+void stats_record(enum chuid_phase_t phase, uint64_t ns)
+{
+	chuid_phase_stats* s = &CHUID_G(stats)[phase];
+	uint64_t bound       = 1000;
+	int i                = 0;
+
+	while (i < CHUID_STATS_BUCKETS - 1 && ns > bound) {
+		bound <<= 1;
+		++i;
+	}
+
+	++s->count;
+	++s->buckets[i];
+	s->total_ns += ns;
+	if (ns > s->max_ns) {
+		s->max_ns = ns;
+	}
+}
+
+void stats_print_info(void)
+{
+	int i;
+	char count[32];
+	char mean[32];
+	char max[32];
+
+	php_info_print_table_start();
+	php_info_print_table_header(4, "Phase", "Count", "Mean, us", "Max, us");
+	for (i=0; i<cph_max; ++i) {
+		const chuid_phase_stats* s = &CHUID_G(stats)[i];
+
+		snprintf(count, sizeof(count), "%llu", (unsigned long long)s->count);
+		snprintf(mean, sizeof(mean), "%.3f", s->count ? (double)s->total_ns / s->count / 1000.0 : 0.0);
+		snprintf(max, sizeof(max), "%.3f", (double)s->max_ns / 1000.0);
+		php_info_print_table_row(4, phase_names[i], count, mean, max);
+	}
+
+	php_info_print_table_end();
+}
+
+/**
+ * The histogram of each phase is keyed by the upper bound of the bucket in microseconds; the last bucket is @c "+Inf".
+ * The statistics belong to the current worker process (thread under ZTS).
+ */
+PHP_FUNCTION(chuid_get_stats)
+{
+	int i;
+	int j;
+	zval cache;
+	zval rpcache;
+	zval phases;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	array_init(return_value);
+	add_assoc_bool(return_value, "enabled", CHUID_G(collect_stats));
+	add_assoc_long(return_value, "warnings_suppressed", (zend_long)CHUID_G(warnings_suppressed));
+
+	array_init(&cache);
+	add_assoc_long(&cache, "entries",   (zend_long)zend_hash_num_elements(&CHUID_G(docroot_cache)));
+	add_assoc_long(&cache, "hits",      (zend_long)CHUID_G(docroot_cache_hits));
+	add_assoc_long(&cache, "shm_hits",  (zend_long)CHUID_G(docroot_cache_shm_hits));
+	add_assoc_long(&cache, "misses",    (zend_long)CHUID_G(docroot_cache_misses));
+	add_assoc_long(&cache, "evictions", (zend_long)CHUID_G(docroot_cache_evictions));
+	add_assoc_zval(return_value, "docroot_cache", &cache);
+
+	array_init(&rpcache);
+	add_assoc_long(&rpcache, "partitions",  (zend_long)zend_hash_num_elements(&CHUID_G(rpcache)));
+	add_assoc_long(&rpcache, "parked_size", CHUID_G(rpcache_parked));
+	add_assoc_zval(return_value, "realpath_cache", &rpcache);
+
+	array_init(&phases);
+	for (i=0; i<cph_max; ++i) {
+		const chuid_phase_stats* s = &CHUID_G(stats)[i];
+		zval phase;
+		zval buckets;
+
+		array_init(&buckets);
+		for (j=0; j<CHUID_STATS_BUCKETS-1; ++j) {
+			add_index_long(&buckets, (zend_ulong)1 << j, (zend_long)s->buckets[j]);
+		}
+
+		add_assoc_long(&buckets, "+Inf", (zend_long)s->buckets[CHUID_STATS_BUCKETS-1]);
+
+		array_init(&phase);
+		add_assoc_long(&phase, "count",    (zend_long)s->count);
+		add_assoc_long(&phase, "total_ns", (zend_long)s->total_ns);
+		add_assoc_long(&phase, "max_ns",   (zend_long)s->max_ns);
+		add_assoc_zval(&phase, "buckets",  &buckets);
+		add_assoc_zval(&phases, phase_names[i], &phase);
+	}
+
+	add_assoc_zval(return_value, "phases", &phases);
+}
@@ -0,0 +1,67 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Per-phase latency statistics — definitions
+ */
+
+#ifndef PHPCHUID_STATS_H_
+#define PHPCHUID_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "php_chuid.h"
+
+/**
+ * @brief Adds a sample to the statistics of the phase
+ * @param phase Phase
+ * @param ns Duration of the phase, ns
+ */
+PHPCHUID_VISIBILITY_HIDDEN void stats_record(enum chuid_phase_t phase, uint64_t ns);
+
+/**
+ * @brief Prints the statistics table for @c phpinfo()
+ */
+PHPCHUID_VISIBILITY_HIDDEN void stats_print_info(void);
+
+/**
+ * @brief Returns the statistics of the current worker: <code>array chuid_get_stats()</code>
+ * @param execute_data Zend Execute Data
+ * @param return_value Return value
+ */
+PHPCHUID_VISIBILITY_HIDDEN PHP_FUNCTION(chuid_get_stats);
+
+/**
+ * @brief Reads the monotonic clock
+ * @return Current time, ns
+ */
+static inline uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Starts timing a phase
+ * @return Start time, 0 if @c chuid.collect_stats is off
+ */
+static inline uint64_t stats_start(void)
+{
+	return UNEXPECTED(CHUID_G(collect_stats)) ? stats_now() : 0;
+}
+
+/**
+ * @brief Finishes timing a phase
+ * @param phase Phase
+ * @param start Value returned by @c stats_start()
+ */
+static inline void stats_stop(enum chuid_phase_t phase, uint64_t start)
+{
+	if (UNEXPECTED(start)) {
+		stats_record(phase, stats_now() - start);
+	}
+}
+
+#endif /* PHPCHUID_STATS_H_ */
@@ -0,0 +1,24 @@
+--TEST--
+CLI: posix_setuid() is disabled by chuid.disable_posix_setuid_family
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=1
+chuid.disable_posix_setuid_family=1
+display_errors=1
+--SKIPIF--
+<?php require 'skipif.inc'; ?>
+--FILE--
+<?php
+echo strlen('chuid'), PHP_EOL;
+posix_setuid(0);
+echo 'Not reached', PHP_EOL;
+?>
+--EXPECTF--
+5
+
+Fatal error: posix_setuid() has been disabled for security reasons in %s on line %d
@@ -0,0 +1,46 @@
+--TEST--
+CLI: chuid_get_stats() reports the phases of the request
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=1
+chuid.collect_stats=1
+--SKIPIF--
+<?php require 'skipif.inc'; ?>
+--FILE--
+<?php
+$stats = chuid_get_stats();
+var_dump($stats['enabled']);
+foreach (['activate', 'docroot', 'stat', 'setgroups', 'setgid', 'setuid', 'chroot', 'deactivate'] as $phase) {
+	$s = $stats['phases'][$phase];
+	echo $phase, ': ', $s['count'], ' ', array_sum($s['buckets']), ' ', (int)($s['max_ns'] <= $s['total_ns']), PHP_EOL;
+}
+
+var_dump(array_keys($stats['docroot_cache']));
+?>
+--EXPECT--
+bool(true)
+activate: 1 1 1
+docroot: 1 1 1
+stat: 1 1 1
+setgroups: 1 1 1
+setgid: 1 1 1
+setuid: 1 1 1
+chroot: 0 0 1
+deactivate: 0 0 1
+array(5) {
+  [0]=>
+  string(7) "entries"
+  [1]=>
+  string(4) "hits"
+  [2]=>
+  string(8) "shm_hits"
+  [3]=>
+  string(6) "misses"
+  [4]=>
+  string(9) "evictions"
+}
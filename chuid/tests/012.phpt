@@ -0,0 +1,29 @@
+--TEST--
+USDT probes are present in the shared object
+--INI--
+chuid.enabled=0
+--SKIPIF--
+<?php
+require 'skipif.inc';
+ob_start();
+phpinfo(INFO_MODULES);
+if (!preg_match('/USDT probes => enabled/', ob_get_clean())) die('SKIP chuid built without --enable-chuid-probes');
+if (!preg_match('!\s(/\S+/chuid\.so)$!m', (string)@file_get_contents('/proc/self/maps'))) die('SKIP chuid.so is not mapped (static build?)');
+?>
+--FILE--
+<?php
+preg_match('!\s(/\S+/chuid\.so)$!m', file_get_contents('/proc/self/maps'), $m);
+$so = file_get_contents($m[1]);
+var_dump(strpos($so, ".note.stapsdt\0") !== false);
+foreach (['activate__start', 'activate__done', 'docroot', 'set__guids', 'chroot', 'deactivate'] as $probe) {
+	echo $probe, ': ', var_export(strpos($so, "chuid\0{$probe}\0") !== false, true), PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+activate__start: true
+activate__done: true
+docroot: true
+set__guids: true
+chroot: true
+deactivate: true
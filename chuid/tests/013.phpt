@@ -0,0 +1,35 @@
+--TEST--
+CLI: UID/GID come from chuid.map_file
+--INI--
+chuid.enabled=0
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (!preg_match('!\s(/\S+/chuid\.so)$!m', (string)@file_get_contents('/proc/self/maps'))) die('SKIP chuid.so is not mapped (static build?)');
+?>
+--FILE--
+<?php
+preg_match('!\s(/\S+/chuid\.so)$!m', file_get_contents('/proc/self/maps'), $m);
+$so  = $m[1];
+$dir = sys_get_temp_dir() . '/chuid-013-' . getmypid();
+mkdir($dir);
+file_put_contents("{$dir}/map.txt", "# prefix uid gid [chroot]\n/ 12345 12346\n/srv/www 20000 20000\n/srv/www/a 20001 20001 /jail/a\n");
+passthru(escapeshellarg(PHP_BINARY) . ' -n ' . escapeshellarg(__DIR__ . '/../tools/chuid-mapc.php') . ' ' . escapeshellarg("{$dir}/map.txt") . ' ' . escapeshellarg("{$dir}/map.bin"), $rc);
+var_dump($rc);
+
+$code = 'preg_match("/^Uid:\\\\s+(\\\\d+)\\\\s+(\\\\d+).*^Gid:\\\\s+(\\\\d+)\\\\s+(\\\\d+)/ms", file_get_contents("/proc/self/status"), $m); echo "$m[1] $m[2] $m[3] $m[4]", PHP_EOL;';
+passthru(
+    escapeshellarg(PHP_BINARY) . ' -n'
+    . ' -d ' . escapeshellarg("extension={$so}")
+    . ' -d chuid.enabled=1 -d chuid.cli_disable=0 -d chuid.never_root=1'
+    . ' -d ' . escapeshellarg("chuid.map_file={$dir}/map.bin")
+    . ' -r ' . escapeshellarg($code)
+);
+
+unlink("{$dir}/map.txt");
+unlink("{$dir}/map.bin");
+rmdir($dir);
+?>
+--EXPECT--
+int(0)
+12345 12345 12346 12346
@@ -0,0 +1,30 @@
+--TEST--
+CLI: chuid.supplementary_groups sets the groups of the user
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=1
+chuid.supplementary_groups=1
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (!posix_getpwnam('nobody')) die('SKIP no "nobody" user');
+if ('' === trim((string)shell_exec('id -G nobody 2>/dev/null'))) die('SKIP id(1) is not available');
+?>
+--FILE--
+<?php
+preg_match('/^Groups:\s*([\d ]*)$/m', file_get_contents('/proc/self/status'), $m);
+$actual   = array_map('intval', preg_split('/\s+/', trim($m[1]), -1, PREG_SPLIT_NO_EMPTY));
+$expected = array_map('intval', preg_split('/\s+/', trim(shell_exec('id -G nobody')), -1, PREG_SPLIT_NO_EMPTY));
+sort($actual);
+sort($expected);
+var_dump($actual === $expected);
+var_dump(posix_getuid() === posix_getpwnam('nobody')['uid']);
+?>
+--EXPECT--
+bool(true)
+bool(true)
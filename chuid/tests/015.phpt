@@ -0,0 +1,84 @@
+--TEST--
+ZTS: with chuid.thread_credentials, CLI still drops the saved UID, and the threads of the script cannot regain root
+--INI--
+chuid.enabled=0
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (!PHP_ZTS) die('SKIP ZTS only');
+if (PHP_OS !== 'Linux') die('SKIP Linux only');
+$maps = (string)@file_get_contents('/proc/self/maps');
+if (!preg_match('!\s(/\S+/chuid\.so)$!m', $maps)) die('SKIP chuid.so is not mapped (static build?)');
+if (!preg_match('!\s(/\S+/parallel\.so)$!m', $maps)) die('SKIP parallel.so is not loaded');
+?>
+--FILE--
+<?php
+$maps = file_get_contents('/proc/self/maps');
+preg_match('!\s(/\S+/chuid\.so)$!m', $maps, $m);
+$chuid = $m[1];
+preg_match('!\s(/\S+/parallel\.so)$!m', $maps, $m);
+$parallel = $m[1];
+
+$dir = sys_get_temp_dir() . '/chuid-015-' . getmypid();
+mkdir($dir);
+file_put_contents("{$dir}/map.txt", "{$dir} 12345 12345\n");
+passthru(escapeshellarg(PHP_BINARY) . ' -n ' . escapeshellarg(__DIR__ . '/../tools/chuid-mapc.php') . ' ' . escapeshellarg("{$dir}/map.txt") . ' ' . escapeshellarg("{$dir}/map.bin"), $rc);
+var_dump($rc);
+
+/*
+ * The script runs as 12345 (it is in the map). CLI changes the credentials irreversibly even per thread:
+ * the threads of ext/parallel inherit those of the script and none of the threads can regain root.
+ */
+file_put_contents("{$dir}/child.php", <<<'EOT'
+<?php
+function uids(string $status): string
+{
+    preg_match('/^Uid:\s+(.*)$/m', (string)file_get_contents($status), $m);
+    return preg_replace('/\s+/', ' ', trim($m[1]));
+}
+
+$futures = [];
+for ($i = 0; $i < 4; ++$i) {
+    $futures[] = \parallel\run(static function (): string {
+        preg_match('/^Uid:\s+(.*)$/m', (string)file_get_contents('/proc/thread-self/status'), $m);
+        return preg_replace('/\s+/', ' ', trim($m[1]));
+    });
+}
+
+foreach ($futures as $future) {
+    echo 'thread ', $future->value(), PHP_EOL;
+}
+
+$root = 0;
+foreach (glob('/proc/self/task/*/status') as $status) {
+    $root += in_array('0', explode(' ', uids($status)), true) ? 1 : 0;
+}
+
+echo 'main ', uids('/proc/thread-self/status'), PHP_EOL;
+echo 'threads with root IDs: ', $root, PHP_EOL;
+EOT
+);
+
+passthru(
+    escapeshellarg(PHP_BINARY) . ' -n'
+    . ' -d ' . escapeshellarg("extension={$parallel}")
+    . ' -d ' . escapeshellarg("extension={$chuid}")
+    . ' -d chuid.enabled=1 -d chuid.cli_disable=0 -d chuid.never_root=1 -d chuid.thread_credentials=1'
+    . ' -d chuid.map_use_script_filename=1'
+    . ' -d ' . escapeshellarg("chuid.map_file={$dir}/map.bin")
+    . ' ' . escapeshellarg("{$dir}/child.php")
+);
+
+unlink("{$dir}/child.php");
+unlink("{$dir}/map.txt");
+unlink("{$dir}/map.bin");
+rmdir($dir);
+?>
+--EXPECT--
+int(0)
+thread 12345 12345 12345 12345
+thread 12345 12345 12345 12345
+thread 12345 12345 12345 12345
+thread 12345 12345 12345 12345
+main 12345 12345 12345 12345
+threads with root IDs: 0
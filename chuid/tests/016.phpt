@@ -0,0 +1,46 @@
+--TEST--
+CLI: chuid.mode=fsuid changes only FSUID and FSGID and lowers CAP_SETUID and CAP_SETGID
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=1
+chuid.mode=fsuid
+disable_functions=exec,passthru,shell_exec,system,proc_open,popen,pcntl_exec,pcntl_setpriority,mail,mb_send_mail
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (PHP_OS !== 'Linux') die('SKIP Linux only');
+ob_start();
+phpinfo(INFO_MODULES);
+if (preg_match('/^capabilities library => none$/m', ob_get_clean())) die('SKIP chuid is built without libcap and libcap-ng');
+?>
+--FILE--
+<?php
+$file = file_get_contents('/proc/self/status');
+$uids = array();
+$gids = array();
+
+preg_match('/^Uid:\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)/m', $file, $uids);
+preg_match('/^Gid:\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)/m', $file, $gids);
+
+var_dump($uids[1] == $uids[2] && $uids[2] == $uids[3] && $uids[1] == posix_getuid());
+var_dump($gids[1] == $gids[2] && $gids[2] == $gids[3] && $gids[1] == posix_getgid());
+var_dump($uids[4] != $uids[1] && $uids[4] != 0);
+var_dump($gids[4] != $gids[1] && $gids[4] != 0);
+var_dump((bool)preg_match('/^Groups:\s*$/m', $file));
+
+// CAP_SETUID (7) and CAP_SETGID (6) are lowered while the request runs
+preg_match('/^CapEff:\s+([0-9a-f]+)/m', $file, $caps);
+var_dump(0 === (hexdec($caps[1]) & ((1 << 7) | (1 << 6))));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
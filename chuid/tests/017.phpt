@@ -0,0 +1,76 @@
+--TEST--
+CLI: chuid.mode=fsuid falls back to the default mode unless the programs it would start as root cannot be started
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=0
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (PHP_OS !== 'Linux') die('SKIP Linux only');
+if (!preg_match('!\s(/\S+/chuid\.so)$!m', (string)@file_get_contents('/proc/self/maps'))) die('SKIP chuid.so is not mapped (static build?)');
+if (0 !== posix_geteuid()) die('SKIP must be run as root');
+ob_start();
+phpinfo(INFO_MODULES);
+if (preg_match('/^capabilities library => none$/m', ob_get_clean())) die('SKIP chuid is built without libcap and libcap-ng');
+?>
+--FILE--
+<?php
+$maps = file_get_contents('/proc/self/maps');
+preg_match('!\s(/\S+/chuid\.so)$!m', $maps, $m);
+$so     = $m[1];
+// posix_kill() must exist in the child
+$posix  = preg_match('!\s(/\S+/posix\.so)$!m', $maps, $m) ? ' -d ' . escapeshellarg("extension={$m[1]}") : '';
+$nobody = posix_getpwnam('nobody')['uid'];
+$log    = sys_get_temp_dir() . '/chuid-017-' . getmypid() . '.log';
+
+// Prints the UIDs of the script and what a program it starts runs as
+$code = <<<'EOT'
+preg_match('/^Uid:\s+(.*)$/m', file_get_contents('/proc/self/status'), $m);
+echo 'script: ', preg_replace('/\s+/', ' ', $m[1]), PHP_EOL;
+echo 'child: ', function_exists('shell_exec') ? trim(shell_exec('id -u')) : 'shell_exec() is disabled', PHP_EOL;
+EOT;
+
+$run = function (string $ini) use ($so, $posix, $code, $log, $nobody): void {
+    @unlink($log);
+    $out = shell_exec(
+        escapeshellarg(PHP_BINARY) . ' -n' . $posix
+        . ' -d ' . escapeshellarg("extension={$so}")
+        . ' -d chuid.enabled=1 -d chuid.cli_disable=0 -d chuid.never_root=1 -d chuid.mode=fsuid'
+        . ' -d display_errors=0 -d log_errors=1 -d ' . escapeshellarg("error_log={$log}")
+        . ' ' . $ini
+        . ' -r ' . escapeshellarg($code)
+    );
+
+    echo str_replace((string)$nobody, '{NOBODY}', $out);
+    echo preg_replace('/^\[[^]]+\] /m', '', (string)@file_get_contents($log)), PHP_EOL;
+};
+
+$unsafe = 'exec,passthru,shell_exec,system,proc_open,popen,pcntl_exec,pcntl_setpriority,mail,mb_send_mail';
+
+echo "Nothing disabled:\n";
+$run('');
+
+echo "posix_kill() is allowed:\n";
+$run('-d disable_functions=' . $unsafe . ' -d chuid.disable_posix_setuid_family=0');
+
+echo "Everything disabled:\n";
+$run('-d disable_functions=' . $unsafe);
+
+@unlink($log);
+?>
+--EXPECT--
+Nothing disabled:
+script: {NOBODY} {NOBODY} {NOBODY} {NOBODY}
+child: {NOBODY}
+PHP Warning:  chuid.mode=fsuid requires exec() to be in disable_functions - using the default mode in Unknown on line 0
+
+posix_kill() is allowed:
+script: {NOBODY} {NOBODY} {NOBODY} {NOBODY}
+child: shell_exec() is disabled
+PHP Warning:  chuid.mode=fsuid requires posix_kill() to be in disable_functions - using the default mode in Unknown on line 0
+
+Everything disabled:
+script: 0 0 0 {NOBODY}
+child: shell_exec() is disabled
+
@@ -0,0 +1,29 @@
+--TEST--
+CLI: chuid.realpath_partitions_size keeps the realpath cache working
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=1
+chuid.realpath_partitions_size=1048576
+--SKIPIF--
+<?php require 'skipif.inc'; ?>
+--FILE--
+<?php
+$stats = chuid_get_stats();
+var_dump($stats['realpath_cache']);
+
+$dir = realpath(sys_get_temp_dir());
+var_dump(isset(realpath_cache_get()[$dir]));
+?>
+--EXPECT--
+array(2) {
+  ["partitions"]=>
+  int(0)
+  ["parked_size"]=>
+  int(0)
+}
+bool(true)
@@ -0,0 +1,24 @@
+--TEST--
+CLI: chuid.docroot_statx and chuid.docroot_base get the owner of DOCUMENT_ROOT
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=0
+chuid.docroot_statx=1
+chuid.docroot_base=/tmp
+--SKIPIF--
+<?php require 'skipif.inc'; ?>
+--FILE--
+<?php
+// DOCUMENT_ROOT is empty in CLI, i.e. "/", which is outside of chuid.docroot_base
+$root = stat('/');
+var_dump(posix_geteuid() === $root['uid']);
+var_dump(posix_getegid() === $root['gid']);
+?>
+--EXPECT--
+bool(true)
+bool(true)
@@ -0,0 +1,29 @@
+--TEST--
+CLI: chuid.prewarm_list fills the DOCUMENT_ROOT cache at startup
+--EXTENSIONS--
+posix
+--INI--
+chuid.enabled=1
+chuid.cli_disable=0
+chuid.default_uid=65534
+chuid.default_gid=65534
+chuid.never_root=0
+chuid.docroot_cache_ttl=60
+chuid.prewarm_list={PWD}/020.lst
+--SKIPIF--
+<?php require 'skipif.inc'; ?>
+--FILE--
+<?php
+// DOCUMENT_ROOT is empty in CLI, i.e. "/", which has been cached before the request
+$root  = stat('/');
+$stats = chuid_get_stats();
+var_dump(posix_geteuid() === $root['uid']);
+var_dump($stats['docroot_cache']['entries']);
+var_dump($stats['docroot_cache']['hits']);
+var_dump($stats['docroot_cache']['misses']);
+?>
+--EXPECT--
+bool(true)
+int(2)
+int(1)
+int(0)
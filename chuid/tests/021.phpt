@@ -0,0 +1,52 @@
+--TEST--
+FastCGI: DOCUMENT_ROOT cache hits, misses, evictions, expiry and cached stat() failures
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir = chuid_test_dir('021');
+[$a, $b] = make_docroots($dir, 2);
+chuid_test_script($dir . '/www/index.php', '<?php
+preg_match("/^Uid:\\s+\\d+\\s+(\\d+)/m", file_get_contents("/proc/self/status"), $m);
+$c = chuid_get_stats()["docroot_cache"];
+printf("uid=%d entries=%d hits=%d misses=%d evictions=%d shm_hits=%d", $m[1], $c["entries"], $c["hits"], $c["misses"], $c["evictions"], $c["shm_hits"]);
+');
+
+[$proc, , $client] = chuid_fcgi_start($dir, [
+    'chuid.default_uid'        => 65534,
+    'chuid.default_gid'        => 65534,
+    'chuid.docroot_cache_ttl'  => 2,
+    'chuid.docroot_cache_size' => 2,
+    'chuid.shm_cache_slots'    => 0,
+]);
+
+$request = function (string $label, string $docroot) use ($client, $dir) {
+    $params = fcgi_params($docroot);
+    $params['SCRIPT_FILENAME'] = $dir . '/www/index.php';
+    echo $label, ': ', chuid_fcgi_body($client, $params), "\n";
+};
+
+$request('miss', $a);
+$request('hit', $a);
+$request('failed stat', $dir . '/missing');
+$request('cached failure', $dir . '/missing');
+$request('evicts the oldest', $b);
+$request('evicted', $a);
+sleep(3);
+$request('expired', $b);
+
+chuid_fcgi_stop($proc);
+rrmdir($dir);
+?>
+--EXPECT--
+miss: uid=20000 entries=1 hits=0 misses=1 evictions=0 shm_hits=0
+hit: uid=20000 entries=1 hits=1 misses=1 evictions=0 shm_hits=0
+failed stat: uid=65534 entries=2 hits=1 misses=2 evictions=0 shm_hits=0
+cached failure: uid=65534 entries=2 hits=2 misses=2 evictions=0 shm_hits=0
+evicts the oldest: uid=20001 entries=2 hits=2 misses=3 evictions=1 shm_hits=0
+evicted: uid=20000 entries=2 hits=2 misses=4 evictions=2 shm_hits=0
+expired: uid=20001 entries=2 hits=2 misses=5 evictions=2 shm_hits=0
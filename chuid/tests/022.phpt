@@ -0,0 +1,47 @@
+--TEST--
+FastCGI: chuid.shm_cache_slots shares the DOCUMENT_ROOT cache between the workers
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir = chuid_test_dir('022');
+[$a] = make_docroots($dir, 1);
+chuid_test_script($dir . '/www/index.php', '<?php
+preg_match("/^Uid:\\s+\\d+\\s+(\\d+)/m", file_get_contents("/proc/self/status"), $m);
+$c = chuid_get_stats()["docroot_cache"];
+printf("%d uid=%d hits=%d shm_hits=%d misses=%d", getmypid(), $m[1], $c["hits"], $c["shm_hits"], $c["misses"]);
+');
+
+[$proc, , $first] = chuid_fcgi_start($dir, [
+    'chuid.docroot_cache_ttl' => 60,
+    'chuid.shm_cache_slots'   => 64,
+], 2);
+
+$params = fcgi_params($a);
+$params['SCRIPT_FILENAME'] = $dir . '/www/index.php';
+
+// The first connection is kept open by its worker, so the second one is accepted by the other worker
+[$pid1, $out] = explode(' ', chuid_fcgi_body($first, $params), 2);
+echo $out, "\n";
+
+$second = new FastCGIClient('unix://' . $dir . '/php.sock');
+[$pid2, $out] = explode(' ', chuid_fcgi_body($second, $params), 2);
+echo $out, "\n";
+var_dump($pid1 !== $pid2);
+
+[, $out] = explode(' ', chuid_fcgi_body($second, $params), 2);
+echo $out, "\n";
+
+unset($first, $second);
+chuid_fcgi_stop($proc);
+rrmdir($dir);
+?>
+--EXPECT--
+uid=20000 hits=0 shm_hits=0 misses=1
+uid=20000 hits=0 shm_hits=1 misses=0
+bool(true)
+uid=20000 hits=1 shm_hits=1 misses=0
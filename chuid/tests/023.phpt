@@ -0,0 +1,64 @@
+--TEST--
+FastCGI: chuid.defer_restore skips the switch for the same owner and restores the credentials before stat()
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir = chuid_test_dir('023');
+[$a, $b] = make_docroots($dir, 2);
+// The user of the previous request cannot reach this document root
+[$c] = make_docroots($dir . '/private', 1, 20002);
+chmod($dir . '/private', 0700);
+
+chuid_test_script($dir . '/www/index.php', '<?php
+preg_match("/^Uid:\\s+\\d+\\s+(\\d+)/m", file_get_contents("/proc/self/status"), $m);
+$p = chuid_get_stats()["phases"];
+printf("uid=%d setuid=%d stat=%d", $m[1], $p["setuid"]["count"], $p["stat"]["count"]);
+');
+
+$ini = [
+    'chuid.docroot_cache_ttl' => 60,
+    'chuid.defer_restore'     => 1,
+    'chuid.collect_stats'     => 1,
+    'cgi.fix_pathinfo'        => 0,
+];
+
+[$proc, , $client] = chuid_fcgi_start($dir, $ini);
+
+$request = function (string $label, string $docroot) use (&$client, $dir) {
+    $params = fcgi_params($docroot);
+    $params['SCRIPT_FILENAME'] = $dir . '/www/index.php';
+    echo $label, ': ', chuid_fcgi_body($client, $params), "\n";
+};
+
+$request('first', $a);
+$request('same owner', $a);
+$request('owner change', $b);
+$request('cache miss', $c);
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+// php-cgi would stat() the script with the credentials of the previous request
+unlink($dir . '/error.log');
+[$proc, , $client] = chuid_fcgi_start($dir, ['cgi.fix_pathinfo' => 1] + $ini);
+$request('fix_pathinfo', $a);
+$request('fix_pathinfo', $a);
+unset($client);
+chuid_fcgi_stop($proc);
+echo trim(preg_replace('/^\[[^]]+\] /m', '', file_get_contents($dir . '/error.log'))), "\n";
+
+rrmdir($dir);
+?>
+--EXPECTF--
+first: uid=20000 setuid=1 stat=1
+same owner: uid=20000 setuid=1 stat=1
+owner change: uid=20001 setuid=2 stat=2
+cache miss: uid=20002 setuid=3 stat=3
+fix_pathinfo: uid=20000 setuid=1 stat=1
+fix_pathinfo: uid=20000 setuid=2 stat=1
+PHP Warning:  chuid.defer_restore requires cgi.fix_pathinfo=0 and has been disabled in %s
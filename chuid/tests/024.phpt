@@ -0,0 +1,72 @@
+--TEST--
+FastCGI: the per-request root is the chuid.chroot_to that SAPI activation yields
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('024');
+$www  = $dir . '/jail/www';
+$code = '<?php echo ini_get("chuid.chroot_to"), "\n", fileinode("/");';
+
+foreach (['', '/p', '/u', '/pu'] as $sub) {
+    chuid_test_script($www . $sub . '/index.php', $code, 20000);
+}
+
+chown($www, 20000);
+file_put_contents($www . '/u/.user.ini', "chuid.chroot_to = \"{$www}/u\"\n");
+file_put_contents($www . '/pu/.user.ini', "chuid.chroot_to = \"{$www}/pu\"\n");
+file_put_contents($dir . '/php.ini', <<<INI
+chuid.chroot_to = "{$dir}/jail"
+
+[HOST=h.example]
+chuid.chroot_to = "{$www}"
+
+[PATH={$www}/p]
+chuid.chroot_to = "{$www}/p"
+
+[PATH={$www}/pu]
+chuid.chroot_to = "{$dir}/jail"
+INI
+);
+
+$cases = [
+    'system'                => ['/index.php', 'localhost'],
+    '[HOST=]'               => ['/index.php', 'H.example'],
+    '[PATH=]'               => ['/p/index.php', 'localhost'],
+    '.user.ini'             => ['/u/index.php', 'localhost'],
+    '[PATH=] and .user.ini' => ['/pu/index.php', 'localhost'],
+];
+
+$run = function (array $ini) use ($dir, $www, $cases) {
+    [$proc, , $client] = chuid_fcgi_start($dir, $ini, 0, $dir . '/php.ini');
+    $result = [];
+    foreach ($cases as $name => [$script, $host]) {
+        $result[$name] = explode("\n", chuid_fcgi_body($client, fcgi_params($www, $script, $host)));
+    }
+
+    unset($client);
+    chuid_fcgi_stop($proc);
+    return $result;
+};
+
+// SAPI activation computes the value; the request runs outside of any jail
+$activated = $run([]);
+$chrooted  = $run(['chuid.enable_per_request_chroot' => 1]);
+
+foreach ($cases as $name => $_) {
+    $root = $activated[$name][0];
+    printf("%s: %s %s\n", $name, str_replace($dir, '', $root), var_export(fileinode($root) === (int)$chrooted[$name][1], true));
+}
+
+rrmdir($dir);
+?>
+--EXPECT--
+system: /jail true
+[HOST=]: /jail/www true
+[PATH=]: /jail/www/p true
+.user.ini: /jail/www/u true
+[PATH=] and .user.ini: /jail/www/pu true
@@ -0,0 +1,79 @@
+--TEST--
+FastCGI: the cached jail descriptor is reopened when the jail is removed, renamed or replaced
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('025');
+$jail = $dir . '/jail';
+
+$make = function (string $path) {
+    chuid_test_script($path . '/index.php', '<?php echo fileinode("/");', 20000);
+    chown($path, 20000);
+    clearstatcache();
+    return fileinode($path);
+};
+
+$run = function (int $ttl, callable $steps) use ($dir, $jail) {
+    [$proc, , $client] = chuid_fcgi_start($dir, [
+        'chuid.enable_per_request_chroot' => 1,
+        'chuid.chroot_to'                 => $jail,
+        'chuid.chroot_fd_cache_size'      => 8,
+        'chuid.chroot_fd_cache_ttl'       => $ttl,
+    ]);
+
+    $steps(function () use ($client, $jail) {
+        return (int)chuid_fcgi_body($client, fcgi_params($jail));
+    });
+
+    unset($client);
+    chuid_fcgi_stop($proc);
+};
+
+$run(0, function (callable $request) use ($make, $dir, $jail) {
+    $first = $make($jail);
+    var_dump($request() === $first);
+
+    rename($jail, $dir . '/renamed');
+    $second = $make($jail);
+    echo 'renamed: ';
+    var_dump($request() === $second);
+
+    rename($jail, $dir . '/other');
+    symlink($dir . '/renamed', $jail);
+    echo 'symlink: ';
+    var_dump($request() === $first);
+
+    unlink($jail);
+    rrmdir($dir . '/renamed');
+    $third = $make($jail);
+    echo 'removed: ';
+    var_dump($request() === $third);
+});
+
+rrmdir($jail);
+rrmdir($dir . '/other');
+
+$run(60, function (callable $request) use ($make, $dir, $jail) {
+    $first = $make($jail);
+    $request();
+
+    // Until the check is due, the worker keeps entering the directory it has open
+    rename($jail, $dir . '/renamed');
+    $make($jail);
+    echo 'within chroot_fd_cache_ttl: ';
+    var_dump($request() === $first);
+});
+
+rrmdir($dir);
+?>
+--EXPECT--
+bool(true)
+renamed: bool(true)
+symlink: bool(true)
+removed: bool(true)
+within chroot_fd_cache_ttl: bool(true)
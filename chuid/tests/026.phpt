@@ -0,0 +1,45 @@
+--TEST--
+FastCGI: the per-request root is stripped from $_SERVER and $_ENV whether they are JIT-created or not, and only when they are created
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('026');
+$jail = $dir . '/jail';
+$www  = $jail . '/www';
+
+chuid_test_script($www . '/none.php', '<?php echo chuid_get_stats()["phases"]["rewrite"]["count"];', 20000);
+chuid_test_script($www . '/server.php', '<?php echo $_SERVER["DOCUMENT_ROOT"], " ", $_SERVER["SCRIPT_FILENAME"];', 20000);
+chuid_test_script($www . '/env.php', '<?php echo $_ENV["DOCUMENT_ROOT"], " ", $_ENV["SCRIPT_FILENAME"];', 20000);
+chown($www, 20000);
+
+foreach ([1, 0] as $jit) {
+    [$proc, , $client] = chuid_fcgi_start($dir, [
+        'chuid.enable_per_request_chroot' => 1,
+        'chuid.chroot_to'                 => $jail,
+        'chuid.collect_stats'             => 1,
+        'auto_globals_jit'                => $jit,
+        'variables_order'                 => 'EGPCS',
+    ]);
+
+    foreach (['none', 'server', 'env'] as $script) {
+        printf("jit=%d %s: %s\n", $jit, $script, chuid_fcgi_body($client, fcgi_params($www, "/{$script}.php")));
+    }
+
+    unset($client);
+    chuid_fcgi_stop($proc);
+}
+
+rrmdir($dir);
+?>
+--EXPECT--
+jit=1 none: 0
+jit=1 server: /www /www/server.php
+jit=1 env: /www /www/env.php
+jit=0 none: 2
+jit=0 server: /www /www/server.php
+jit=0 env: /www /www/env.php
@@ -0,0 +1,42 @@
+--TEST--
+FastCGI: chuid.chroot_rewrite_vars parsing (whitespace, empty items, duplicates) and stripping of custom variables
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('027');
+$jail = $dir . '/jail';
+// A variable stripped twice would lose the second copy of the jail path as well
+$www  = $jail . $jail . '/www';
+
+chuid_test_script($www . '/index.php', '<?php foreach (["DOCUMENT_ROOT", "SCRIPT_FILENAME", "MY_PATH", "NEAR", "OTHER"] as $v) echo $v, "=", $_SERVER[$v], "\n";', 20000);
+chown($www, 20000);
+
+[$proc, , $client] = chuid_fcgi_start($dir, [
+    'chuid.enable_per_request_chroot' => 1,
+    'chuid.chroot_to'                 => $jail,
+    'chuid.chroot_rewrite_vars'       => " DOCUMENT_ROOT,,SCRIPT_FILENAME\tMY_PATH , DOCUMENT_ROOT,NEAR,",
+]);
+
+$params = fcgi_params($www) + [
+    'MY_PATH' => $jail . '/data',
+    'NEAR'    => $dir . '/jail2/data',
+    'OTHER'   => $jail . '/data',
+];
+
+echo str_replace($dir, '{DIR}', chuid_fcgi_body($client, $params));
+
+unset($client);
+chuid_fcgi_stop($proc);
+rrmdir($dir);
+?>
+--EXPECT--
+DOCUMENT_ROOT={DIR}/jail/www
+SCRIPT_FILENAME={DIR}/jail/www/index.php
+MY_PATH=/data
+NEAR={DIR}/jail2/data
+OTHER={DIR}/jail/data
@@ -0,0 +1,73 @@
+--TEST--
+FastCGI: chuid.metrics_file is written once per chuid.metrics_interval and at shutdown, never through a planted symlink
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('028');
+$file = $dir . '/metrics/chuid.prom';
+[$a]  = make_docroots($dir, 1);
+
+mkdir($dir . '/metrics');
+file_put_contents($dir . '/victim', "victim\n");
+symlink($dir . '/victim', $file);
+
+// The metrics are written after the response has been sent
+$wait = function () use ($file) {
+    for ($i = 0; $i < 200 && (is_link($file) || !is_file($file)); ++$i) {
+        usleep(10000);
+        clearstatcache();
+    }
+
+    clearstatcache();
+};
+
+$show = function (string $label) use ($file) {
+    preg_match_all('/^(chuid_(?:requests|switches)_total) (\d+)$/m', (string)@file_get_contents($file), $m, PREG_SET_ORDER);
+    echo $label, ': ';
+    foreach ($m as $line) {
+        echo $line[1], '=', $line[2], ' ';
+    }
+
+    echo "\n";
+};
+
+[$proc, , $client] = chuid_fcgi_start($dir, [
+    'chuid.metrics_slots'    => 4,
+    'chuid.metrics_file'     => $file,
+    'chuid.metrics_interval' => 3600,
+]);
+
+$client->request(fcgi_params($a));
+$wait();
+$show('first request');
+var_dump(is_link($file), decoct(fileperms($file) & 0777), file_get_contents($dir . '/victim'));
+
+unlink($file);
+$client->request(fcgi_params($a));
+$client->request(fcgi_params($a));
+usleep(200000);
+echo 'within the interval: ';
+var_dump(file_exists($file));
+
+unset($client);
+chuid_fcgi_stop($proc);
+$show('shutdown');
+var_dump(glob($file . '.*'));
+
+rrmdir($dir);
+?>
+--EXPECT--
+first request: chuid_requests_total=1 chuid_switches_total=1
+bool(false)
+string(3) "644"
+string(7) "victim
+"
+within the interval: bool(false)
+shutdown: chuid_requests_total=3 chuid_switches_total=3
+array(0) {
+}
@@ -0,0 +1,44 @@
+--TEST--
+FastCGI: chuid.warning_interval suppresses repeated DOCUMENT_ROOT errors per errno and reports them once the interval expires
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir     = chuid_test_dir('029');
+[$a]     = make_docroots($dir, 1);
+$missing = $dir . '/d/x';
+chuid_test_script($dir . '/www/index.php', '<?php echo chuid_get_stats()["warnings_suppressed"];');
+
+[$proc, , $client] = chuid_fcgi_start($dir, ['chuid.warning_interval' => 2]);
+
+$request = function (string $docroot) use ($client, $dir) {
+    $params = fcgi_params($docroot);
+    $params['SCRIPT_FILENAME'] = $dir . '/www/index.php';
+    return chuid_fcgi_body($client, $params);
+};
+
+$request($missing);                 // ENOENT: reported
+$request($missing);                 // suppressed
+$request($missing);                 // suppressed
+touch($dir . '/d');
+echo $request($missing), "\n";      // ENOTDIR: another error, reported
+sleep(3);
+echo $request($a), "\n";            // the summary is written when the request finishes
+usleep(200000);
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+echo str_replace($dir, '{DIR}', preg_replace('/^\[[^]]+\] /m', '', file_get_contents($dir . '/error.log')));
+rrmdir($dir);
+?>
+--EXPECTF--
+2
+2
+PHP Warning:  stat({DIR}/d/x): No such file or directory in %s
+PHP Warning:  stat({DIR}/d/x): Not a directory in %s
+PHP Warning:  stat({DIR}/d/x) failed 2 more times in the last 2s: No such file or directory
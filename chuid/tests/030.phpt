@@ -0,0 +1,76 @@
+--TEST--
+FastCGI: chuid.map_file picks the longest prefix at a component boundary, sets the per-request root and looks up SCRIPT_FILENAME
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('030');
+$srv  = $dir . '/srv';
+$jail = $dir . '/jail';
+
+chuid_test_script($srv . '/a/index.php', CHUID_UID_SCRIPT);
+chuid_test_script($srv . '/a/deep/index.php', CHUID_UID_SCRIPT);
+chuid_test_script($srv . '/ab/index.php', CHUID_UID_SCRIPT);
+foreach (['/a' => 20011, '/ab' => 20010] as $root => $owner) {
+    chown($srv . $root, $owner);
+    chgrp($srv . $root, $owner);
+}
+
+// /proc is not available in the jail: the script leaves a file owned by the user it runs as
+chuid_test_script($jail . '/www/index.php', '<?php touch("/www/out"); echo file_exists("/www/index.php") ? "jailed" : "not jailed";');
+chown($jail . '/www', 20003);
+
+file_put_contents($dir . '/map.txt', "{$srv}/a 20001 20001\n{$srv}/a/deep/ 20002 20002\n{$srv}/j 20003 20003 {$jail}\n");
+passthru(escapeshellarg(PHP_BINARY) . ' -n ' . escapeshellarg(__DIR__ . '/../tools/chuid-mapc.php') . ' ' . escapeshellarg("{$dir}/map.txt") . ' ' . escapeshellarg("{$dir}/map.bin"), $rc);
+var_dump($rc);
+
+$ini = [
+    'chuid.map_file'                  => $dir . '/map.bin',
+    'chuid.enable_per_request_chroot' => 1,
+];
+
+[$proc, , $client] = chuid_fcgi_start($dir, $ini);
+
+foreach (['/a', '/a/', '/a/deep', '/ab'] as $root) {
+    printf("%s: %s\n", $root, chuid_fcgi_body($client, fcgi_params($srv . $root)));
+}
+
+$params = fcgi_params($srv . '/j');
+$params['SCRIPT_FILENAME'] = $jail . '/www/index.php';
+printf("/j: %s, %d\n", chuid_fcgi_body($client, $params), fileowner($jail . '/www/out'));
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+[$proc, , $client] = chuid_fcgi_start($dir, $ini + ['chuid.map_use_script_filename' => 1]);
+
+// DOCUMENT_ROOT is not in the map, the script is
+$params = fcgi_params($srv . '/ab');
+$params['SCRIPT_FILENAME'] = $srv . '/a/deep/index.php';
+printf("script /a/deep, docroot /ab: %s\n", chuid_fcgi_body($client, $params));
+// Neither is: the owner of DOCUMENT_ROOT
+printf("script /ab, docroot /ab: %s\n", chuid_fcgi_body($client, fcgi_params($srv . '/ab')));
+// DOCUMENT_ROOT is, but only SCRIPT_FILENAME is looked up: the owner of DOCUMENT_ROOT
+$params = fcgi_params($srv . '/a');
+$params['SCRIPT_FILENAME'] = $srv . '/ab/index.php';
+printf("script /ab, docroot /a: %s\n", chuid_fcgi_body($client, $params));
+
+unset($client);
+chuid_fcgi_stop($proc);
+echo file_get_contents($dir . '/error.log');
+rrmdir($dir);
+?>
+--EXPECT--
+int(0)
+/a: 20001 20001
+/a/: 20001 20001
+/a/deep: 20002 20002
+/ab: 20010 20010
+/j: jailed, 20003
+script /a/deep, docroot /ab: 20002 20002
+script /ab, docroot /ab: 20010 20010
+script /ab, docroot /a: 20011 20011
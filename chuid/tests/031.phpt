@@ -0,0 +1,82 @@
+--TEST--
+CLI: chuid-mapc.php rejects UIDs and GIDs which do not fit, chuid rejects short, corrupt and out-of-range map files
+--INI--
+chuid.enabled=0
+--SKIPIF--
+<?php
+require 'skipif.inc';
+if (!preg_match('!\s(/\S+/chuid\.so)$!m', (string)@file_get_contents('/proc/self/maps'))) die('SKIP chuid.so is not mapped (static build?)');
+?>
+--FILE--
+<?php
+preg_match('!\s(/\S+/chuid\.so)$!m', file_get_contents('/proc/self/maps'), $m);
+$so  = $m[1];
+$dir = sys_get_temp_dir() . '/chuid-031-' . getmypid();
+mkdir($dir);
+
+$compile = function (string $map) use ($dir): int {
+    file_put_contents("{$dir}/map.txt", $map);
+    exec(escapeshellarg(PHP_BINARY) . ' -n ' . escapeshellarg(__DIR__ . '/../tools/chuid-mapc.php') . ' ' . escapeshellarg("{$dir}/map.txt") . ' ' . escapeshellarg("{$dir}/map.bin") . ' 2>&1', $output, $rc);
+    echo str_replace($dir, '{DIR}', implode("\n", $output)), $output ? "\n" : '';
+    return $rc;
+};
+
+$run = function () use ($so, $dir): void {
+    @unlink("{$dir}/error.log");
+    $code = 'preg_match("/^Uid:\\\\s+(\\\\d+)/m", file_get_contents("/proc/self/status"), $m); echo $m[1], PHP_EOL;';
+    passthru(
+        escapeshellarg(PHP_BINARY) . ' -n'
+        . ' -d ' . escapeshellarg("extension={$so}")
+        . ' -d chuid.enabled=1 -d chuid.cli_disable=0 -d chuid.never_root=1 -d chuid.default_uid=12346 -d chuid.default_gid=12346'
+        . ' -d ' . escapeshellarg("chuid.map_file={$dir}/map.bin")
+        . ' -d display_errors=0 -d log_errors=1 -d ' . escapeshellarg("error_log={$dir}/error.log")
+        . ' -r ' . escapeshellarg($code)
+    );
+    echo str_replace($dir, '{DIR}', preg_replace('/^\[[^]]+\] /m', '', (string)@file_get_contents("{$dir}/error.log")));
+};
+
+var_dump($compile("/ 4294967295 1\n"));
+var_dump($compile("/ 1 4294967296\n"));
+var_dump($compile("/ 99999999999999999999 1\n"));
+var_dump($compile("/ 04294967294 4294967294\n"));
+
+var_dump($compile("/ 12345 12345\n"));
+$map = file_get_contents("{$dir}/map.bin");
+echo "valid: ";
+$run();
+
+echo "short: ";
+file_put_contents("{$dir}/map.bin", substr($map, 0, 20));
+$run();
+
+echo "truncated: ";
+file_put_contents("{$dir}/map.bin", substr($map, 0, -4));
+$run();
+
+echo "(uid_t)-1: ";
+$values = unpack('L', $map, 24)[1];
+file_put_contents("{$dir}/map.bin", substr_replace($map, pack('L', 0xFFFFFFFF), $values, 4));
+$run();
+
+foreach (['map.txt', 'map.bin', 'error.log'] as $file) {
+    @unlink("{$dir}/{$file}");
+}
+
+rmdir($dir);
+?>
+--EXPECT--
+{DIR}/map.txt:1: uid and gid must be less than 4294967295
+int(1)
+{DIR}/map.txt:1: uid and gid must be less than 4294967295
+int(1)
+{DIR}/map.txt:1: uid and gid must be less than 4294967295
+int(1)
+int(0)
+int(0)
+valid: 12345
+short: 12346
+PHP Warning:  {DIR}/map.bin is not a valid chuid map file in Unknown on line 0
+truncated: 12346
+PHP Warning:  {DIR}/map.bin is not a valid chuid map file in Unknown on line 0
+(uid_t)-1: 12346
+PHP Warning:  {DIR}/map.bin is not a valid chuid map file in Unknown on line 0
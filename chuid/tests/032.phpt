@@ -0,0 +1,67 @@
+--TEST--
+FastCGI: chuid.vhost_file matches exact and wildcard names regardless of the case, the port and the trailing dot, and rejects invalid IDs
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir = chuid_test_dir('032');
+$www = $dir . '/www';
+chuid_test_script($www . '/index.php', CHUID_UID_SCRIPT);
+chown($www, 20010);
+chgrp($www, 20010);
+
+file_put_contents($dir . '/vhosts.txt', <<<'EOT'
+# host uid gid
+example.com        20001 20001
+*.example.com      20002 20002
+  www.example.com. 20003 20003
+EXAMPLE.org:8080   20004 20004
+neg.example.net    -1 20005
+big.example.net    4294967295 20005
+huge.example.net   99999999999999999999 20005
+hex.example.net    0x10 20005
+extra.example.net  20005 20005 20005
+short.example.net  20005
+EOT
+);
+
+[$proc, , $client] = chuid_fcgi_start($dir, ['chuid.vhost_file' => $dir . '/vhosts.txt']);
+
+$hosts = [
+    'example.com', 'Example.COM.', 'a.b.example.com', 'www.example.com', 'example.org:443', 'www.example.org',
+    'neg.example.net', 'big.example.net', 'huge.example.net', 'hex.example.net', 'extra.example.net', 'short.example.net',
+];
+
+foreach ($hosts as $host) {
+    printf("%s: %s\n", $host, chuid_fcgi_body($client, fcgi_params($www, '/index.php', $host)));
+}
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+echo str_replace($dir, '{DIR}', preg_replace('/^\[[^]]+\] /m', '', file_get_contents($dir . '/error.log')));
+rrmdir($dir);
+?>
+--EXPECT--
+example.com: 20001 20001
+Example.COM.: 20001 20001
+a.b.example.com: 20002 20002
+www.example.com: 20003 20003
+example.org:443: 20004 20004
+www.example.org: 20010 20010
+neg.example.net: 20010 20010
+big.example.net: 20010 20010
+huge.example.net: 20010 20010
+hex.example.net: 20010 20010
+extra.example.net: 20010 20010
+short.example.net: 20010 20010
+PHP Warning:  {DIR}/vhosts.txt:6: expected "host uid gid" in Unknown on line 0
+PHP Warning:  {DIR}/vhosts.txt:7: expected "host uid gid" in Unknown on line 0
+PHP Warning:  {DIR}/vhosts.txt:8: expected "host uid gid" in Unknown on line 0
+PHP Warning:  {DIR}/vhosts.txt:9: expected "host uid gid" in Unknown on line 0
+PHP Warning:  {DIR}/vhosts.txt:10: expected "host uid gid" in Unknown on line 0
+PHP Warning:  {DIR}/vhosts.txt:11: expected "host uid gid" in Unknown on line 0
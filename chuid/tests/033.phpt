@@ -0,0 +1,68 @@
+--TEST--
+FastCGI: chuid.realpath_partitions_size parks the realpath cache per user, restores it and evicts the least recently used partitions
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir   = chuid_test_dir('033');
+$roots = make_docroots($dir, 4);
+$names = ['A', 'B', 'C', 'D'];
+
+// Prints the markers in the realpath cache of the request, then caches its own one
+$code = <<<'EOT'
+<?php
+$seen = [];
+foreach (array_keys(realpath_cache_get()) as $path) {
+    if ('marker' === basename($path)) {
+        $seen[] = basename(dirname($path));
+    }
+}
+
+sort($seen);
+$stats = chuid_get_stats()['realpath_cache'];
+echo implode(',', $seen) ?: '-', ' ', $stats['partitions'], ' ', $stats['parked_size'];
+realpath(__DIR__ . '/marker');
+EOT;
+
+foreach ($roots as $i => $root) {
+    mkdir($root . '/marker');
+    chuid_test_script($root . '/index.php', $code, 20000 + $i);
+}
+
+$request = function (FastCGIClient $client, string $name) use ($roots, $names): array {
+    return explode(' ', chuid_fcgi_body($client, fcgi_params($roots[array_search($name, $names, true)])));
+};
+
+// The size of a partition: its entries plus its copy of the bucket array
+[$proc, , $client] = chuid_fcgi_start($dir, ['chuid.realpath_partitions_size' => 1 << 30]);
+$request($client, 'A');
+$cost = (int)$request($client, 'B')[2];
+unset($client);
+chuid_fcgi_stop($proc);
+var_dump($cost > 8 * 1024);
+
+// Room for two partitions, not for three
+[$proc, , $client] = chuid_fcgi_start($dir, ['chuid.realpath_partitions_size' => (int)($cost * 2.5)]);
+foreach (['A', 'B', 'A', 'C', 'D', 'A', 'B', 'C'] as $name) {
+    [$seen, $partitions] = $request($client, $name);
+    printf("%s: %s, %d parked\n", $name, strtr($seen, ['site000' => 'A', 'site001' => 'B', 'site002' => 'C', 'site003' => 'D']), $partitions);
+}
+
+unset($client);
+chuid_fcgi_stop($proc);
+rrmdir($dir);
+?>
+--EXPECT--
+bool(true)
+A: -, 0 parked
+B: -, 1 parked
+A: A, 1 parked
+C: -, 2 parked
+D: -, 2 parked
+A: A, 2 parked
+B: -, 2 parked
+C: -, 2 parked
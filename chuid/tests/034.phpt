@@ -0,0 +1,77 @@
+--TEST--
+FastCGI: DOCUMENT_ROOTs below chuid.docroot_base are resolved relative to its descriptor; a base which cannot be opened is ignored
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir = chuid_test_dir('034');
+
+$tree = function (string $base, int $owner): void {
+    rrmdir($base);
+    chuid_test_script($base . '/site/index.php', CHUID_UID_SCRIPT);
+    chuid_test_script($base . '/index.php', CHUID_UID_SCRIPT);
+    chown($base, $owner + 1);
+    chgrp($base, $owner + 1);
+    chown($base . '/site', $owner);
+    chgrp($base . '/site', $owner);
+};
+
+$show = function (FastCGIClient $client) use ($dir): void {
+    foreach (['/real/site', '/real', '/other/site'] as $root) {
+        printf("%s: %s\n", $root, chuid_fcgi_body($client, fcgi_params($dir . $root)));
+    }
+};
+
+$tree($dir . '/other', 20010);
+foreach ([0, 1] as $statx) {
+    echo "docroot_statx={$statx}\n";
+    $tree($dir . '/real', 20000);
+    [$proc, , $client] = chuid_fcgi_start($dir, ['chuid.docroot_base' => $dir . '/real/', 'chuid.docroot_statx' => $statx]);
+
+    /*
+     * The base is replaced after it has been opened: the paths below it are still looked up in the old tree,
+     * the base itself and the paths outside of it are looked up by their names
+     */
+    rrmdir($dir . '/moved');
+    rename($dir . '/real', $dir . '/moved');
+    $tree($dir . '/real', 20005);
+    $show($client);
+
+    unset($client);
+    chuid_fcgi_stop($proc);
+}
+
+foreach (['/missing', '/'] as $base) {
+    echo "docroot_base={$base}\n";
+    [$proc, , $client] = chuid_fcgi_start($dir, ['chuid.docroot_base' => '/' === $base ? $base : $dir . $base]);
+    $show($client);
+    unset($client);
+    chuid_fcgi_stop($proc);
+}
+
+echo str_replace($dir, '{DIR}', preg_replace('/^\[[^]]+\] /m', '', file_get_contents($dir . '/error.log')));
+rrmdir($dir);
+?>
+--EXPECT--
+docroot_statx=0
+/real/site: 20000 20000
+/real: 20006 20006
+/other/site: 20010 20010
+docroot_statx=1
+/real/site: 20000 20000
+/real: 20006 20006
+/other/site: 20010 20010
+docroot_base=/missing
+/real/site: 20005 20005
+/real: 20006 20006
+/other/site: 20010 20010
+docroot_base=/
+/real/site: 20005 20005
+/real: 20006 20006
+/other/site: 20010 20010
+PHP Warning:  open({DIR}/missing): No such file or directory in Unknown on line 0
+PHP Warning:  chuid.docroot_base must be an absolute path other than /: / in Unknown on line 0
@@ -0,0 +1,132 @@
+--TEST--
+FastCGI: chuid.stay_in_jail stays for the same root, leaves for another root, no root, cache misses, a replaced jail and the metrics file, and requires cgi.fix_pathinfo=0
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir   = chuid_test_dir('035');
+$jail1 = $dir . '/jail1';
+$jail2 = $dir . '/jail2';
+$plain = $dir . '/plain';
+
+// The root directory of the request and the number of chroot()s made by the worker so far
+$code = '<?php echo fileinode("/"), " ", chuid_get_stats()["phases"]["chroot"]["count"];';
+
+$make_jail1 = function () use ($jail1, $code): void {
+    foreach (['/www/index.php', '/www/sub/index.php', '/www2/index.php'] as $script) {
+        chuid_test_script($jail1 . $script, $code, 20001);
+    }
+
+    chown($jail1 . '/www', 20001);
+    chown($jail1 . '/www2', 20001);
+};
+
+$make_jail1();
+chuid_test_script($jail2 . '/www/index.php', $code, 20002);
+chown($jail2 . '/www', 20002);
+file_put_contents($jail2 . '/www/.user.ini', "chuid.chroot_to = \"{$jail2}\"\n");
+chuid_test_script($plain . '/index.php', $code, 20003);
+chown($plain, 20003);
+file_put_contents($plain . '/.user.ini', "chuid.chroot_to = \"\"\n");
+
+$names = [fileinode($jail1) => 'jail1', fileinode($jail2) => 'jail2', fileinode('/') => '/'];
+
+$request = function (FastCGIClient $client, string $label, string $docroot, string $script = '/index.php') use (&$names): void {
+    [$root, $count] = explode(' ', chuid_fcgi_body($client, fcgi_params($docroot, $script)));
+    printf("%s: %s, %d chroot()s\n", $label, $names[(int)$root] ?? $root, $count);
+};
+
+$ini = [
+    'chuid.enable_per_request_chroot' => 1,
+    'chuid.stay_in_jail'              => 1,
+    'chuid.chroot_to'                 => $jail1,
+    'chuid.collect_stats'             => 1,
+    'chuid.docroot_cache_ttl'         => 60,
+    'chuid.chroot_fd_cache_size'      => 8,
+    'chuid.chroot_fd_cache_ttl'       => 1,
+    'cgi.fix_pathinfo'                => 0,
+];
+
+[$proc, , $client] = chuid_fcgi_start($dir, $ini);
+
+$request($client, 'jail1', $jail1 . '/www');
+$request($client, 'jail1 again', $jail1 . '/www');
+$request($client, 'jail2', $jail2 . '/www');
+$request($client, 'jail2 again', $jail2 . '/www');
+$request($client, 'jail1', $jail1 . '/www');
+$request($client, 'no root', $plain);
+$request($client, 'no root again', $plain);
+$request($client, 'jail1', $jail1 . '/www');
+$request($client, 'DOCUMENT_ROOT cache miss', $jail1 . '/www2');
+$request($client, 'chroot_to cache miss', $jail1 . '/www', '/sub/index.php');
+$request($client, 'jail1 again', $jail1 . '/www');
+
+// The jail is replaced: once chuid.chroot_fd_cache_ttl expires, the worker notices and enters the new one
+rename($jail1, $dir . '/old');
+$make_jail1();
+$names[fileinode($jail1)] = 'new jail1';
+sleep(2);
+$request($client, 'replaced jail1', $jail1 . '/www');
+$request($client, 'replaced jail1 again', $jail1 . '/www');
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+// The metrics file is written outside of the jail: the worker leaves it when the file is due
+$file = $dir . '/chuid.prom';
+[$proc, , $client] = chuid_fcgi_start($dir, $ini + [
+    'chuid.metrics_slots'    => 4,
+    'chuid.metrics_file'     => $file,
+    'chuid.metrics_interval' => 3,
+]);
+
+$request($client, 'metrics due', $jail1 . '/www');
+$request($client, 'metrics written', $jail1 . '/www');
+$request($client, 'metrics not due', $jail1 . '/www');
+sleep(4);
+$request($client, 'metrics due', $jail1 . '/www');
+$request($client, 'metrics written', $jail1 . '/www');
+preg_match('/^chuid_requests_total (\d+)$/m', (string)file_get_contents($file), $m);
+echo 'chuid_requests_total: ', $m[1], "\n";
+
+unset($client);
+chuid_fcgi_stop($proc);
+
+// php-cgi would resolve SCRIPT_FILENAME inside the jail of the previous request
+@unlink($dir . '/error.log');
+[$proc, , $client] = chuid_fcgi_start($dir, ['cgi.fix_pathinfo' => 1] + $ini);
+$request($client, 'fix_pathinfo', $jail1 . '/www');
+$request($client, 'fix_pathinfo', $jail1 . '/www');
+unset($client);
+chuid_fcgi_stop($proc);
+echo trim(preg_replace('/^\[[^]]+\] /m', '', file_get_contents($dir . '/error.log'))), "\n";
+
+rrmdir($dir);
+?>
+--EXPECTF--
+jail1: jail1, 1 chroot()s
+jail1 again: jail1, 1 chroot()s
+jail2: jail2, 2 chroot()s
+jail2 again: jail2, 2 chroot()s
+jail1: jail1, 3 chroot()s
+no root: /, 3 chroot()s
+no root again: /, 3 chroot()s
+jail1: jail1, 4 chroot()s
+DOCUMENT_ROOT cache miss: jail1, 5 chroot()s
+chroot_to cache miss: jail1, 6 chroot()s
+jail1 again: jail1, 6 chroot()s
+replaced jail1: new jail1, 7 chroot()s
+replaced jail1 again: new jail1, 7 chroot()s
+metrics due: new jail1, 1 chroot()s
+metrics written: new jail1, 2 chroot()s
+metrics not due: new jail1, 2 chroot()s
+metrics due: new jail1, 2 chroot()s
+metrics written: new jail1, 3 chroot()s
+chuid_requests_total: 4
+fix_pathinfo: new jail1, 1 chroot()s
+fix_pathinfo: new jail1, 2 chroot()s
+PHP Warning:  chuid.stay_in_jail requires cgi.fix_pathinfo=0 and has been disabled in %s
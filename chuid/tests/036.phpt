@@ -0,0 +1,52 @@
+--TEST--
+FastCGI: chuid.prewarm_list opens the jail descriptors and caches chuid.chroot_to and the owner of the document root before the first request
+--EXTENSIONS--
+posix
+--SKIPIF--
+<?php require 'skipif.inc'; require 'fcgi.inc'; chuid_fcgi_skipif(); ?>
+--FILE--
+<?php
+require __DIR__ . '/fcgi.inc';
+
+$dir  = chuid_test_dir('036');
+$jail = $dir . '/jail';
+$www  = $jail . '/www';
+$list = $dir . '/prewarm.lst';
+
+foreach ([0, 60] as $ttl) {
+    chuid_test_script($www . '/index.php', '<?php echo fileinode("/"), " ", posix_geteuid();', 20000);
+    chown($www, 20000);
+    file_put_contents($www . '/.user.ini', "chuid.chroot_to = \"{$jail}\"\n");
+    file_put_contents($list, "{$www} localhost\n");
+
+    [$proc, $pid, $client] = chuid_fcgi_start($dir, [
+        'chuid.enable_per_request_chroot' => 1,
+        'chuid.prewarm_list'              => $list,
+        'chuid.docroot_cache_ttl'         => $ttl,
+        'chuid.chroot_fd_cache_size'      => 8,
+        'chuid.chroot_fd_cache_ttl'       => 60,
+        'cgi.fix_pathinfo'                => 0,
+    ]);
+
+    // The descriptor of the jail is opened before any request
+    $fds = array_map('readlink', glob("/proc/{$pid}/fd/*"));
+    printf("ttl=%d jail descriptor: %s\n", $ttl, var_export(in_array($jail, $fds, true), true));
+
+    // The changes made after the startup are not seen while the cached entries are valid
+    file_put_contents($www . '/.user.ini', "chuid.chroot_to = \"\"\n");
+    chown($www, 20005);
+
+    [$root, $euid] = explode(' ', chuid_fcgi_body($client, fcgi_params($www)));
+    printf("ttl=%d root: %s, euid: %d\n", $ttl, (int)$root === fileinode($jail) ? 'jail' : $root, $euid);
+
+    unset($client);
+    chuid_fcgi_stop($proc);
+}
+
+rrmdir($dir);
+?>
+--EXPECT--
+ttl=0 jail descriptor: true
+ttl=0 root: jail, euid: 20005
+ttl=60 jail descriptor: true
+ttl=60 root: jail, euid: 20000
@@ -0,0 +1,197 @@
+<?php
+/**
+ * Compiles a chuid map file (see chuid.map_file).
+ *
+ * Usage: php chuid-mapc.php input.txt output.map
+ *
+ * Every non-empty line of the input which does not start with # is "prefix uid gid [chroot]", where prefix is an absolute
+ * path. The prefix matches whole path components only: /srv/a matches /srv/a and /srv/a/www, but not /srv/ab.
+ * The longest matching prefix wins. The output is written to a temporary file and renamed, so the running
+ * PHP processes keep using the old map until they are restarted.
+ *
+ * The map uses the byte order of the machine it has been compiled on.
+ */
+
+const MAP_MAGIC     = 'CHUIDMP1';
+const MAP_NO_CHROOT = 0xFFFFFFFF;
+const HEADER_SIZE   = 40;
+
+function fail(string $message): void
+{
+    fwrite(STDERR, $message . PHP_EOL);
+    exit(1);
+}
+
+function valid_id(string $id): bool
+{
+    $id = ltrim($id, '0');
+    return strlen($id) < 10 || (10 === strlen($id) && strcmp($id, '4294967295') < 0);
+}
+
+/**
+ * @return array<string,array{int,int,?string}>
+ */
+function parse_map(string $file): array
+{
+    $lines = @file($file, FILE_IGNORE_NEW_LINES);
+    if (false === $lines) {
+        fail("Cannot read {$file}");
+    }
+
+    $entries = [];
+    foreach ($lines as $n => $line) {
+        $line = trim($line);
+        if ('' === $line || '#' === $line[0]) {
+            continue;
+        }
+
+        $parts = preg_split('/\s+/', $line);
+        if (count($parts) < 3 || count($parts) > 4 || '/' !== $parts[0][0] || !ctype_digit($parts[1]) || !ctype_digit($parts[2])) {
+            fail(sprintf('%s:%d: expected "prefix uid gid [chroot]"', $file, $n + 1));
+        }
+
+        // 4294967295 is (uid_t)-1, which setresuid() takes for "do not change"; pack('L') would truncate the larger values
+        if (!valid_id($parts[1]) || !valid_id($parts[2])) {
+            fail(sprintf('%s:%d: uid and gid must be less than 4294967295', $file, $n + 1));
+        }
+
+        $chroot = $parts[3] ?? null;
+        if (null !== $chroot && '/' !== $chroot[0]) {
+            fail(sprintf('%s:%d: chroot must be an absolute path', $file, $n + 1));
+        }
+
+        // "/srv/a/" and "/srv/a" are the same prefix; "/" is the empty prefix which matches everything
+        $prefix = rtrim($parts[0], '/');
+        if (isset($entries[$prefix])) {
+            fail(sprintf('%s:%d: duplicate prefix %s', $file, $n + 1, $parts[0]));
+        }
+
+        $entries[$prefix] = [(int)$parts[1], (int)$parts[2], $chroot];
+    }
+
+    return $entries;
+}
+
+final class MapCompiler
+{
+    /** @var string[] */
+    private $keys;
+    /** @var array<string,array{int,int,?string}> */
+    private $entries;
+    /** @var int[][] node => [value, first_edge, num_edges] */
+    private $nodes = [];
+    /** @var int[][] edge => [label_off, label_len, child] */
+    private $edges = [];
+    /** @var int[][] value => [uid, gid, chroot_off, chroot_len] */
+    private $values = [];
+    /** @var string */
+    private $strings = '';
+
+    /**
+     * @param array<string,array{int,int,?string}> $entries
+     */
+    public function __construct(array $entries)
+    {
+        $this->entries = $entries;
+        $this->keys    = array_map('strval', array_keys($entries));
+        sort($this->keys, SORT_STRING);
+    }
+
+    public function compile(): string
+    {
+        $this->node(0, count($this->keys), 0);
+
+        $nodes_off   = HEADER_SIZE;
+        $edges_off   = $nodes_off  + 16 * count($this->nodes);
+        $values_off  = $edges_off  + 12 * count($this->edges);
+        $strings_off = $values_off + 16 * count($this->values);
+
+        $out = MAP_MAGIC . pack('L8', $nodes_off, count($this->nodes), $edges_off, count($this->edges), $values_off, count($this->values), $strings_off, strlen($this->strings));
+        foreach ($this->nodes as $n) {
+            $out .= pack('L4', $n[0], $n[1], $n[2], 0);
+        }
+
+        foreach ($this->edges as $e) {
+            $out .= pack('L3', $e[0], $e[1], $e[2]);
+        }
+
+        foreach ($this->values as $v) {
+            $out .= pack('L4', $v[0], $v[1], $v[2], $v[3]);
+        }
+
+        return $out . $this->strings;
+    }
+
+    /**
+     * Builds the node for the sorted keys [$lo, $hi) which share the first $depth bytes
+     */
+    private function node(int $lo, int $hi, int $depth): int
+    {
+        $index = count($this->nodes);
+        $value = 0;
+
+        if ($lo < $hi && strlen($this->keys[$lo]) === $depth) {
+            $value = $this->value($this->entries[$this->keys[$lo]]);
+            ++$lo;
+        }
+
+        // Group the keys by the byte at $depth; the edges of the node must be contiguous, so they are reserved first
+        $groups = [];
+        for ($i = $lo; $i < $hi; $i = $j) {
+            $c = $this->keys[$i][$depth];
+            for ($j = $i + 1; $j < $hi && $this->keys[$j][$depth] === $c; ++$j) {
+            }
+
+            $groups[] = [$i, $j];
+        }
+
+        $first_edge          = count($this->edges);
+        $this->nodes[$index] = [$value, $first_edge, count($groups)];
+        foreach ($groups as $k => $g) {
+            $this->edges[$first_edge + $k] = null;
+        }
+
+        foreach ($groups as $k => [$a, $b]) {
+            $first = $this->keys[$a];
+            $last  = $this->keys[$b - 1];
+            $end   = min(strlen($first), strlen($last));
+            for ($lcp = $depth + 1; $lcp < $end && $first[$lcp] === $last[$lcp]; ++$lcp) {
+            }
+
+            $label_off = strlen($this->strings);
+            $this->strings .= substr($first, $depth, $lcp - $depth);
+            $this->edges[$first_edge + $k] = [$label_off, $lcp - $depth, $this->node($a, $b, $lcp)];
+        }
+
+        return $index;
+    }
+
+    /**
+     * @param array{int,int,?string} $entry
+     */
+    private function value(array $entry): int
+    {
+        [$uid, $gid, $chroot] = $entry;
+        $chroot_off = MAP_NO_CHROOT;
+        $chroot_len = 0;
+        if (null !== $chroot) {
+            $chroot_off = strlen($this->strings);
+            $chroot_len = strlen($chroot);
+            $this->strings .= $chroot . "\0";
+        }
+
+        $this->values[] = [$uid, $gid, $chroot_off, $chroot_len];
+        return count($this->values);
+    }
+}
+
+if ($argc !== 3) {
+    fail("Usage: php {$argv[0]} input.txt output.map");
+}
+
+$map = (new MapCompiler(parse_map($argv[1])))->compile();
+$tmp = $argv[2] . '.' . getmypid() . '.tmp';
+if (false === file_put_contents($tmp, $map) || !rename($tmp, $argv[2])) {
+    @unlink($tmp);
+    fail("Cannot write {$argv[2]}");
+}
@@ -0,0 +1,221 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Host name → identity table — implementation
+ *
+ * The table is a persistent hash table built in MINIT and never modified afterwards. Host names are stored lowercased
+ * and without the trailing dot; <code>*.example.com</code> entries match any subdomain of @c example.com.
+ * A lookup takes one hash lookup for the exact name plus one per label for the wildcards, and never touches the filesystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "vhosts.h"
+
+/**
+ * @brief Maximum length of a host name
+ */
+#define VHOST_NAME_MAX 255
+
+/**
+ * @brief Identity of a host
+ */
+typedef struct _vhost_entry {
+	uid_t uid; /**< UID */
+	gid_t gid; /**< GID */
+} vhost_entry;
+
+/**
+ * @brief Host name → @c vhost_entry
+ */
+static HashTable vhost_table;
+
+/**
+ * @brief Whether @c vhost_table has been initialized
+ */
+static int vhost_table_loaded = 0;
+
+/**
+ * @brief Entry destructor
+ * @param zv Entry to destroy
+ */
+static void vhost_dtor(zval* zv)
+{
+	pefree(Z_PTR_P(zv), 1);
+}
+
+/**
+ * @brief Normalizes the host name: strips the port and the trailing dot, lowercases the name
+ * @param host Host name
+ * @param len Length of @c host
+ * @param buf [out] Normalized name
+ * @return Length of the normalized name, 0 if the name is empty or too long
+ */
+static size_t normalize_host(const char* host, size_t len, char* buf)
+{
+	size_t i;
+	const char* end;
+
+	if ('[' == *host) {
+		/* IPv6 literal */
+		end = memchr(host, ']', len);
+		len = end ? (size_t)(end - host) + 1 : len;
+	}
+	else if ((end = memchr(host, ':', len))) {
+		len = (size_t)(end - host);
+	}
+
+	if (len && '.' == host[len-1]) {
+		--len;
+	}
+
+	if (!len || len > VHOST_NAME_MAX) {
+		return 0;
+	}
+
+	for (i=0; i<len; ++i) {
+		buf[i] = (char)tolower((unsigned char)host[i]);
+	}
+
+	buf[len] = 0;
+	return len;
+}
+
+/**
+ * @brief Parses a UID or a GID
+ * @param p Position in the line
+ * @param max The value which is not a valid ID (<code>(uid_t)-1</code> or <code>(gid_t)-1</code>)
+ * @param id [out] Parsed value
+ * @return Position after the number, @c NULL if the value is not valid
+ *
+ * @c strtoul() accepts a sign and wraps negative values around, so <code>-1</code> would become <code>(uid_t)-1</code>,
+ * which means "do not change" to @c setresuid() and would leave the request running as root
+ */
+static char* parse_id(char* p, unsigned long int max, unsigned long int* id)
+{
+	char* end;
+
+	while (isspace((unsigned char)*p)) {
+		++p;
+	}
+
+	if (!isdigit((unsigned char)*p)) {
+		return NULL;
+	}
+
+	errno = 0;
+	*id   = strtoul(p, &end, 10);
+	if (errno || *id >= max || (*end && !isspace((unsigned char)*end))) {
+		return NULL;
+	}
+
+	return end;
+}
+
+int vhosts_load(const char* path)
+{
+	char line[1024];
+	unsigned int n = 0;
+	FILE* f        = fopen(path, "r");
+
+	if (!f) {
+		PHPCHUID_ERROR(E_CORE_WARNING, "fopen(%s): %s", path, strerror(errno));
+		return FAILURE;
+	}
+
+	zend_hash_init(&vhost_table, 64, NULL, vhost_dtor, 1);
+	vhost_table_loaded = 1;
+
+	while (fgets(line, sizeof(line), f)) {
+		char host[VHOST_NAME_MAX + 1];
+		char name[VHOST_NAME_MAX + 1];
+		unsigned long int uid;
+		unsigned long int gid;
+		size_t len;
+		int pos;
+		vhost_entry e;
+		char* p = line;
+
+		++n;
+		while (isspace((unsigned char)*p)) {
+			++p;
+		}
+
+		if (!*p || '#' == *p) {
+			continue;
+		}
+
+		if (
+			   1 != sscanf(p, "%255s%n", host, &pos)
+			|| !(len = normalize_host(host, strlen(host), name))
+			|| !(p = parse_id(p + pos, (unsigned long int)(uid_t)-1, &uid))
+			|| !(p = parse_id(p, (unsigned long int)(gid_t)-1, &gid))
+			|| p[strspn(p, " \t\r\n\v\f")]
+		) {
+			PHPCHUID_ERROR(E_CORE_WARNING, "%s:%u: expected \"host uid gid\"", path, n);
+			continue;
+		}
+
+		e.uid = (uid_t)uid;
+		e.gid = (gid_t)gid;
+		zend_hash_str_update_mem(&vhost_table, name, len, &e, sizeof(e));
+	}
+
+	fclose(f);
+	return SUCCESS;
+}
+
+void vhosts_free(void)
+{
+	if (vhost_table_loaded) {
+		zend_hash_destroy(&vhost_table);
+		vhost_table_loaded = 0;
+	}
+}
+
+int vhosts_loaded(void)
+{
+	return vhost_table_loaded;
+}
+
+/**
+ * For @c www.example.com, tries @c www.example.com, @c *.example.com and @c *.com, in that order.
+ */
+int vhosts_lookup(uid_t* uid, gid_t* gid)
+{
+	char buf[VHOST_NAME_MAX + 3];
+	char* name = buf + 2;
+	char* host = NULL;
+	const char* var = CHUID_G(vhost_variable);
+	size_t len;
+	size_t i;
+	vhost_entry* e;
+
+	if (!vhost_table_loaded || !sapi_module.getenv || !var || !*var) {
+		return FAILURE;
+	}
+
+	host = sapi_module.getenv((char*)var, strlen(var));
+	if (!host || !*host || !(len = normalize_host(host, strlen(host), name))) {
+		return FAILURE;
+	}
+
+	e = zend_hash_str_find_ptr(&vhost_table, name, len);
+	for (i=0; !e && i<len; ++i) {
+		if ('.' == name[i]) {
+			/* "*" followed by the suffix starting at this dot */
+			name[i-1] = '*';
+			e = zend_hash_str_find_ptr(&vhost_table, name + i - 1, len - i + 1);
+		}
+	}
+
+	if (!e) {
+		return FAILURE;
+	}
+
+	*uid = e->uid;
+	*gid = e->gid;
+	return SUCCESS;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file
+ * @author Volodymyr Kolesnykov <volodymyr@wildwolf.name>
+ * @version 1.1.0
+ * @brief Host name → identity table — definitions
+ */
+
+#ifndef PHPCHUID_VHOSTS_H_
+#define PHPCHUID_VHOSTS_H_
+
+#include "php_chuid.h"
+
+/**
+ * @brief Loads the table from the file
+ * @param path Path to the file with <code>host uid gid</code> lines
+ * @return Whether the table has been loaded
+ * @retval SUCCESS Yes (invalid lines are reported and skipped)
+ * @retval FAILURE No (the file cannot be read)
+ * @note Called in MINIT, so that the forked workers share the table
+ */
+PHPCHUID_VISIBILITY_HIDDEN int vhosts_load(const char* path);
+
+/**
+ * @brief Frees the table
+ */
+PHPCHUID_VISIBILITY_HIDDEN void vhosts_free(void);
+
+/**
+ * @brief Whether the table is loaded
+ * @return Whether the table is loaded
+ */
+PHPCHUID_VISIBILITY_HIDDEN int vhosts_loaded(void);
+
+/**
+ * @brief Looks up the host name of the request
+ * @param uid [out] UID
+ * @param gid [out] GID
+ * @return Whether the host has been found
+ * @retval SUCCESS Yes
+ * @retval FAILURE No (the SAPI does not provide the variable named by @c chuid.vhost_variable, or the host is not in the table)
+ */
+PHPCHUID_VISIBILITY_HIDDEN int vhosts_lookup(uid_t* uid, gid_t* gid);
+
+#endif /* PHPCHUID_VHOSTS_H_ */